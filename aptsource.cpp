@@ -0,0 +1,418 @@
+#include "aptsource.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QUrl>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// parse lines like "# deb [arch=amd64] http://mxrepo.com/mx/repo/ bullseye main non-free"
+AptSource AptSource::parse(const QString &line)
+{
+    AptSource source;
+    source.text = line;
+
+    QString entry = line.trimmed();
+    source.enabled = !entry.startsWith('#');
+    while (entry.startsWith('#'))
+        entry.remove(0, 1);
+    entry = entry.section('#', 0, 0).simplified(); // drop trailing comments
+
+    const QString type = entry.section(' ', 0, 0);
+    if (type != "deb" && type != "deb-src")
+        return source;
+
+    QString rest = entry.mid(type.length()).trimmed();
+    if (rest.startsWith('[')) {
+        const int end = rest.indexOf(']');
+        if (end < 0)
+            return source;
+        const QString options = rest.mid(1, end - 1).trimmed();
+        if (!options.isEmpty())
+            source.options = options.split(' ');
+        rest = rest.mid(end + 1).trimmed();
+    }
+
+    const QStringList fields = rest.split(' ');
+    if (fields.size() < 2 || fields.at(0).isEmpty())
+        return source;
+
+    source.type = type;
+    source.uri = fields.at(0);
+    source.suite = fields.at(1);
+    source.components = fields.mid(2);
+    return source;
+}
+
+QString AptSource::baseUri() const
+{
+    return uri.endsWith('/') ? uri : uri + '/';
+}
+
+// base URI apt downloads from, for "mirror+file:" the mirror it tries first (lowest priority, else the first line);
+// apt still names the files in /var/lib/apt/lists after the "mirror+file:" URI
+QString AptSource::fetchUri() const
+{
+    if (!uri.startsWith("mirror+file:"))
+        return baseUri();
+    QFile file(uri.mid(QStringLiteral("mirror+file:").length()));
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return baseUri();
+    static const QRegularExpression priority_re("\\bpriority:(\\d+)");
+    QString first;
+    int first_priority = std::numeric_limits<int>::max();
+    for (const QString &line : QString::fromUtf8(file.readAll()).split('\n')) {
+        const QString entry = line.trimmed();
+        if (entry.isEmpty() || entry.startsWith('#'))
+            continue;
+        const QRegularExpressionMatch match = priority_re.match(entry);
+        const int priority = match.hasMatch() ? match.captured(1).toInt() : std::numeric_limits<int>::max() - 1;
+        if (first.isEmpty() || priority < first_priority) {
+            first = entry.section(QRegularExpression("\\s+"), 0, 0);
+            first_priority = priority;
+        }
+    }
+    if (first.isEmpty())
+        return baseUri();
+    return first.endsWith('/') ? first : first + '/';
+}
+
+// architectures this entry fetches, "arch=" restricts the ones dpkg is configured for
+QStringList AptSource::architectures(const QStringList &host_archs) const
+{
+    for (const QString &option : options)
+        if (option.startsWith("arch="))
+            return option.section('=', 1).split(',');
+    return host_archs;
+}
+
+// index files relative to the base URI without compression extension, as apt fetches them
+QStringList AptSource::indexPaths(const QStringList &host_archs) const
+{
+    const bool flat = suite.endsWith('/');
+    const QString dist = flat ? (suite == "./" ? QString() : suite) : "dists/" + suite + '/';
+    QStringList paths {dist + "InRelease"};
+    if (flat) {
+        paths << dist + (type == "deb-src" ? "Sources" : "Packages");
+        return paths;
+    }
+    for (const QString &component : components) {
+        if (type == "deb-src") {
+            paths << dist + component + "/source/Sources";
+        } else {
+            for (const QString &arch : architectures(host_archs))
+                paths << dist + component + "/binary-" + arch + "/Packages";
+        }
+    }
+    return paths;
+}
+
+QStringList AptSource::indexUrls(const QStringList &host_archs) const
+{
+    QStringList urls;
+    const QString base = fetchUri();
+    for (const QString &path : indexPaths(host_archs))
+        urls << base + path + (path.endsWith("InRelease") ? QString() : QStringLiteral(".xz"));
+    return urls;
+}
+
+// names of the files in /var/lib/apt/lists that apt keeps for this entry (without compression extension)
+QStringList AptSource::listFileNames(const QStringList &host_archs) const
+{
+    QStringList names;
+    for (const QString &path : indexPaths(host_archs))
+        names << uriToFileName(baseUri() + path);
+    return names;
+}
+
+// same archive whatever the spelling: scheme and host in lower case, http and https alike,
+// default ports and repeated or trailing slashes dropped; "arch=" is part of it since it changes what is fetched
+QString AptSource::archiveKey() const
+{
+    QUrl url(uri);
+    QString scheme = url.scheme().toLower();
+    if (scheme == "https")
+        scheme = "http";
+    const QString host = url.host().toLower();
+    QString path = url.path().replace(QRegularExpression("/{2,}"), "/");
+    while (path.endsWith('/'))
+        path.chop(1);
+    const int port = url.port();
+    const bool default_port = port < 0 || (scheme == "http" && (port == 80 || port == 443)) || (scheme == "ftp" && port == 21);
+    QString archive = scheme + "://" + host + (default_port ? QString() : ':' + QString::number(port)) + path;
+    if (host.isEmpty()) // file:, cdrom:, mirror+file:
+        archive = uri.section('/', 0, -1, QString::SectionSkipEmpty);
+
+    QString suite_key = suite;
+    if (suite_key.endsWith('/') && suite_key != "./")
+        suite_key.chop(1);
+    QStringList archs;
+    for (const QString &option : options)
+        if (option.startsWith("arch="))
+            archs = option.section('=', 1).split(',');
+    archs.sort();
+    return type + ' ' + archive + ' ' + suite_key + ' ' + archs.join(',');
+}
+
+// the line with "arch=" set to archs, other options, comments and spacing kept
+QString AptSource::withArchitectures(const QStringList &archs) const
+{
+    QStringList new_options {"arch=" + archs.join(',')};
+    for (const QString &option : options)
+        if (!option.startsWith("arch="))
+            new_options << option;
+    static const QRegularExpression re("^(\\s*#*\\s*deb(-src)?)\\s+(\\[[^\\]]*\\]\\s*)?");
+    return QString(text).replace(re, "\\1 [" + new_options.join(' ') + "] ");
+}
+
+// shell-style "*" and "?", both also match "/" as in URIs; everything else is taken literally
+static QRegularExpression wildcard(const QString &pattern)
+{
+    QString re;
+    for (const QChar c : pattern) {
+        if (c == '*')
+            re += ".*";
+        else if (c == '?')
+            re += '.';
+        else
+            re += QRegularExpression::escape(QString(c));
+    }
+    return QRegularExpression('^' + re + '$', QRegularExpression::CaseInsensitiveOption);
+}
+
+SourceFilter::SourceFilter(const QString &pattern)
+{
+    static const QStringList fields {"uri", "suite", "component", "type", "file"};
+    for (const QString &term : pattern.simplified().split(' ', QString::SkipEmptyParts)) {
+        const QString field = term.section(':', 0, 0).toLower();
+        if (term.contains(':') && fields.contains(field))
+            terms << qMakePair(field, wildcard(term.section(':', 1)));
+        else
+            terms << qMakePair(QString(), wildcard('*' + term + '*'));
+    }
+}
+
+bool SourceFilter::matches(const QString &file, const AptSource &source) const
+{
+    if (!source.isValid())
+        return false;
+    const QString file_name = file.section('/', -1);
+    for (const QPair<QString, QRegularExpression> &term : terms) {
+        const QString &field = term.first;
+        const QRegularExpression &re = term.second;
+        const auto match = [&re](const QString &text) { return re.match(text).hasMatch(); };
+        bool found = false;
+        if (field.isEmpty() || field == "uri")
+            found = match(source.uri);
+        if (!found && (field.isEmpty() || field == "suite"))
+            found = match(source.suite);
+        if (!found && (field.isEmpty() || field == "component"))
+            found = std::any_of(source.components.cbegin(), source.components.cend(), match);
+        if (!found && (field.isEmpty() || field == "type"))
+            found = match(source.type);
+        if (!found && (field.isEmpty() || field == "file"))
+            found = match(file_name) || match(file);
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+// find entries fetching indexes that earlier entries (in the order apt reads them) fetch already
+QList<SourceOverlap> findOverlaps(const QList<AptSource> &sources)
+{
+    QList<SourceOverlap> overlaps;
+    QHash<QString, QHash<QString, int>> fetched; // archive key -> component -> first entry
+    for (int i = 0; i < sources.size(); ++i) {
+        const AptSource &source = sources.at(i);
+        if (!source.isValid() || !source.enabled)
+            continue;
+        QHash<QString, int> &components = fetched[source.archiveKey()];
+        QStringList own = source.components;
+        if (own.isEmpty()) // flat repo
+            own << QString();
+        own.removeDuplicates();
+        SourceOverlap overlap {i, -1, {}, false};
+        for (const QString &component : qAsConst(own)) {
+            const auto it = components.constFind(component);
+            if (it == components.constEnd()) {
+                components.insert(component, i);
+                continue;
+            }
+            if (overlap.original < 0)
+                overlap.original = it.value();
+            overlap.shared << component;
+        }
+        if (overlap.shared.isEmpty())
+            continue;
+        overlap.redundant = overlap.shared.size() == own.size();
+        overlaps << overlap;
+    }
+    return overlaps;
+}
+
+UpdateLine UpdateLine::parse(const QString &line)
+{
+    static const QRegularExpression line_re("^(Hit|Get|Ign|Err):\\d+\\s+(\\S+)\\s+(\\S+)(.*)$");
+    static const QRegularExpression size_re("\\[([\\d.,]+)\\s*([kMGT]?)B\\]");
+    UpdateLine update;
+    const QRegularExpressionMatch match = line_re.match(line);
+    if (!match.hasMatch())
+        return update;
+    update.status = match.captured(1);
+    update.uri = match.captured(2);
+    update.target = match.captured(3);
+    update.index = QString(match.captured(4)).remove(size_re).trimmed();
+    const QRegularExpressionMatch size = size_re.match(match.captured(4));
+    if (size.hasMatch()) {
+        const double value = size.captured(1).remove(',').toDouble();
+        const int power = QStringLiteral(" kMGT").indexOf(size.captured(2).isEmpty() ? QStringLiteral(" ") : size.captured(2));
+        update.bytes = qRound64(value * std::pow(1000, power));
+    }
+    return update;
+}
+
+// apt prints the URI without trailing slash and the suite with the component appended; the (In)Release file is
+// shared by all lines of the archive, the indexes of a component belong to the "deb" or the "deb-src" line
+bool UpdateLine::matches(const AptSource &source) const
+{
+    QString source_uri = source.uri;
+    while (source_uri.endsWith('/'))
+        source_uri.chop(1);
+    QString own_uri = uri;
+    while (own_uri.endsWith('/'))
+        own_uri.chop(1);
+    if (own_uri != source_uri)
+        return false;
+    if (target == source.suite)
+        return true;
+    if (!target.startsWith(source.suite + '/') || !source.components.contains(target.mid(source.suite.length() + 1)))
+        return false;
+    const bool sources_index = index.contains("Sources") || index.contains("(dsc)");
+    return sources_index == (source.type == "deb-src");
+}
+
+// list files by name without compression extension, one pass over the directory
+QHash<QString, QFileInfo> scanAptLists(const QString &dir)
+{
+    static const QStringList extensions {".gz", ".xz", ".lz4", ".bz2", ".lzma", ".zst"};
+    QHash<QString, QFileInfo> lists;
+    for (const QFileInfo &file_info : QDir(dir).entryInfoList(QDir::Files)) {
+        QString name = file_info.fileName();
+        for (const QString &extension : extensions) {
+            if (name.endsWith(extension)) {
+                name.chop(extension.length());
+                break;
+            }
+        }
+        lists.insert(name, file_info);
+    }
+    return lists;
+}
+
+// same as apt's URItoFileName(): drop scheme and credentials, quote special characters, '/' becomes '_'
+QString uriToFileName(const QString &uri)
+{
+    QString rest = uri.section("://", 1);
+    if (rest.isEmpty())
+        rest = uri.section(':', 1);
+    const int slash = rest.indexOf('/');
+    const int at = rest.lastIndexOf('@', slash < 0 ? -1 : slash);
+    if (at >= 0)
+        rest.remove(0, at + 1);
+
+    static const QByteArray special {"\\|{}[]<>\"^~_=!@#$%^&*"};
+    QString name;
+    for (const char c : rest.toUtf8()) {
+        const auto u = static_cast<unsigned char>(c);
+        if (u <= 0x20 || u >= 0x7F || special.contains(c))
+            name += QString::asprintf("%%%02x", u);
+        else
+            name += QLatin1Char(c);
+    }
+    return name.replace('/', '_');
+}
+
+// apply edit() to every line and replace the file in one atomic write, unchanged files are not touched
+bool rewriteAptFile(const QString &file, const std::function<QString(const QString &line)> &edit)
+{
+    QFile in(file);
+    if (!in.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qDebug() << "Could not open file:" << file;
+        return false;
+    }
+    const QStringList lines = QString::fromUtf8(in.readAll()).split('\n');
+    in.close();
+
+    QStringList new_lines;
+    new_lines.reserve(lines.size());
+    for (const QString &line : lines)
+        new_lines << edit(line);
+    if (new_lines == lines)
+        return true;
+
+    QSaveFile out(file);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qDebug() << "Could not write file:" << file;
+        return false;
+    }
+    out.write(new_lines.join('\n').toUtf8());
+    if (!out.commit()) {
+        qDebug() << "Could not write file:" << file;
+        return false;
+    }
+    return true;
+}
+
+// edit several files as one change: if one of them can't be written, the ones already written are put back
+bool rewriteAptFiles(const QStringList &files, const std::function<QString(const QString &file, const QString &line)> &edit)
+{
+    QHash<QString, QByteArray> originals;
+    for (const QString &file : files) {
+        QFile in(file);
+        if (!in.open(QIODevice::ReadOnly)) {
+            qDebug() << "Could not open file:" << file;
+            return false;
+        }
+        originals.insert(file, in.readAll());
+    }
+    QStringList written;
+    for (const QString &file : files) {
+        if (rewriteAptFile(file, [&edit, &file](const QString &line) { return edit(file, line); })) {
+            written << file;
+            continue;
+        }
+        for (const QString &done : qAsConst(written)) {
+            QSaveFile out(done);
+            if (!out.open(QIODevice::WriteOnly) || out.write(originals.value(done)) < 0 || !out.commit())
+                qDebug() << "Could not restore file:" << done;
+        }
+        return false;
+    }
+    return true;
+}
+
+// apt "mirror+file:" list, lower priority is tried first
+bool writeMirrorList(const QString &file, const QStringList &uris)
+{
+    QSaveFile out(file);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qDebug() << "Could not write file:" << file;
+        return false;
+    }
+    out.write("# Generated by " + qAppName().toUtf8() + ", changes will be overwritten\n");
+    for (int i = 0; i < uris.size(); ++i)
+        out.write(QString("%1\tpriority:%2\n").arg(uris.at(i)).arg(i + 1).toUtf8());
+    if (!out.commit()) {
+        qDebug() << "Could not write file:" << file;
+        return false;
+    }
+    QFile::setPermissions(file, QFile::ReadOwner | QFile::WriteOwner | QFile::ReadGroup | QFile::ReadOther);
+    return true;
+}
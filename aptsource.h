@@ -0,0 +1,82 @@
+#ifndef APTSOURCE_H
+#define APTSOURCE_H
+
+#include <QFileInfo>
+#include <QHash>
+#include <QPair>
+#include <QRegularExpression>
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+
+// one "deb"/"deb-src" line of a one-line-style APT source file
+class AptSource
+{
+public:
+    static AptSource parse(const QString &line);
+
+    bool isValid() const { return !type.isEmpty(); }
+    QString baseUri() const;
+    QString fetchUri() const;
+    QStringList architectures(const QStringList &host_archs) const;
+    QStringList indexPaths(const QStringList &host_archs) const;
+    QStringList indexUrls(const QStringList &host_archs) const;
+    QStringList listFileNames(const QStringList &host_archs) const;
+    QString archiveKey() const;
+    QString withArchitectures(const QStringList &archs) const;
+
+    QString text;           // line as found in the file
+    QString type;           // "deb" or "deb-src", empty if the line is not a source
+    QStringList options;    // content of [ ... ], e.g. "arch=amd64"
+    QString uri;
+    QString suite;
+    QStringList components;
+    bool enabled = false;
+};
+
+// "uri:*backports*", "suite:*-backports", "component:non-free", "type:deb-src", "file:mx*.list" or just "backports"
+// for any of them; every term has to match, wildcards are case-insensitive. Matching doesn't change the filter,
+// one filter can be used by several threads.
+class SourceFilter
+{
+public:
+    explicit SourceFilter(const QString &pattern);
+    bool isEmpty() const { return terms.isEmpty(); }
+    bool matches(const QString &file, const AptSource &source) const;
+
+private:
+    QList<QPair<QString, QRegularExpression>> terms;
+};
+
+// an enabled entry whose indexes are also fetched by an earlier one, apt downloads and merges them twice
+struct SourceOverlap
+{
+    int entry;              // index in the list passed to findOverlaps()
+    int original;           // earlier entry that fetches the first shared component
+    QStringList shared;     // components fetched by both
+    bool redundant;         // every component is fetched elsewhere, the entry can be disabled
+};
+
+// one "Get:3 http://mxrepo.com/mx/repo bullseye/main amd64 Packages [300 kB]" line of "LANG=C apt-get update"
+struct UpdateLine
+{
+    static UpdateLine parse(const QString &line);
+    bool isValid() const { return !status.isEmpty(); }
+    bool matches(const AptSource &source) const;
+
+    QString status;     // "Hit", "Get", "Ign" or "Err"
+    QString uri;
+    QString target;     // suite, followed by "/" and the component for files other than (In)Release
+    QString index;      // what the file is, e.g. "InRelease", "amd64 Packages", "Sources" or "Translation-en"
+    qint64 bytes = 0;   // size given for "Get"
+};
+
+QList<SourceOverlap> findOverlaps(const QList<AptSource> &sources);
+QHash<QString, QFileInfo> scanAptLists(const QString &dir = "/var/lib/apt/lists");
+QString uriToFileName(const QString &uri);
+bool rewriteAptFile(const QString &file, const std::function<QString(const QString &line)> &edit);
+bool rewriteAptFiles(const QStringList &files, const std::function<QString(const QString &file, const QString &line)> &edit);
+bool writeMirrorList(const QString &file, const QStringList &uris);
+
+#endif // APTSOURCE_H
@@ -0,0 +1,316 @@
+#include "cli.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QTextStream>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+#include "aptsource.h"
+#include "metrics.h"
+#include "mirrorprobe.h"
+#include "repoconfig.h"
+
+Cli::Cli(QObject *parent)
+    : QObject(parent)
+{
+    session = new ProbeSession(&manager, this);
+    policy = RankingPolicy::fromSettings(settings);
+    cache_proxies = settings.value("cacheProxies").toStringList();
+    metrics_dir = settings.value("metricsDir").toString();
+    mirror_list = settings.value("mirrorList", "/usr/share/mx-repo-list/repos.txt").toString();
+    probe_timeout = settings.value("probeTimeout", 5000).toInt();
+}
+
+// probe the MX mirrors and publish the ranking for other hosts
+int Cli::exportRanking(const QString &target, const QString &network)
+{
+    const QString ver_name = debianVerName(debianVerNum());
+    if (ver_name.isEmpty()) {
+        qCritical().noquote() << "Could not detect Debian version";
+        return EXIT_FAILURE;
+    }
+    MirrorProbe probe(&manager);
+    probe.timeout = probe_timeout;
+    probe.session = session;
+    Ranking ranking;
+    ranking.mirrors = probe.run(repoUrls(readRepoList(mirror_list)), "/mx/repo/dists/" + ver_name + "/InRelease");
+    ranking.timestamp = QDateTime::currentDateTimeUtc();
+    ranking.network = network;
+    const bool found = !ranking.mirrors.isEmpty() && ranking.mirrors.first().ok();
+    writeProbeMetrics(metrics_dir, "cli", "mx", ranking.mirrors, found ? ranking.mirrors.first().url : QString());
+    if (!found) {
+        qCritical().noquote() << "Could not detect fastest repo.";
+        return EXIT_FAILURE;
+    }
+    if (!publishRanking(&manager, target, ranking.toJson(policy.key))) {
+        qCritical().noquote() << "Could not publish ranking to" << target;
+        return EXIT_FAILURE;
+    }
+    qInfo().noquote() << "Published ranking of" << ranking.mirrors.size() << "mirrors to" << target;
+    return EXIT_SUCCESS;
+}
+
+// probe the MX mirrors and local caches (or use a fresh shared ranking) once per Debian release of the roots,
+// each root gets the fastest mirror for its release
+int Cli::fastest(const QStringList &roots)
+{
+    QMap<QString, QStringList> releases; // code name -> roots
+    for (const QString &root : roots)
+        releases[debianVerName(debianVerNum(root))] << root;
+    QHash<QString, QString> urls; // root -> mirror
+    int failed = 0;
+    for (auto it = releases.constBegin(); it != releases.constEnd(); ++it) {
+        if (it.key().isEmpty()) {
+            for (const QString &root : it.value())
+                qCritical().noquote() << root << "has an unknown Debian version";
+            failed += it.value().size();
+            continue;
+        }
+        const QString url = fastestFor(it.key(), it.value());
+        if (url.isEmpty()) {
+            qCritical().noquote() << "Could not detect fastest repo for" << it.key();
+            failed += it.value().size();
+            continue;
+        }
+        qInfo().noquote() << "Fastest mirror for" << it.key() << url;
+        for (const QString &root : it.value())
+            urls.insert(root, url);
+    }
+    QStringList ready;
+    for (const QString &root : roots)
+        if (urls.contains(root))
+            ready << root;
+    if (!ready.isEmpty() && applyToRoots(ready, urls) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// fastest mirror for the roots of one release, empty if none answered
+QString Cli::fastestFor(const QString &ver_name, const QStringList &roots)
+{
+    MirrorProbe probe(&manager);
+    probe.timeout = probe_timeout;
+    probe.session = session;
+    probe.proxy = aptProxy(roots.first());
+    const QStringList repos = readRepoList(mirror_list);
+    QStringList mirrors = repoUrls(repos);
+    // the default cache is the one on this host, it is only worth trying for this host;
+    // chroots and images get a cache only when it was given explicitly
+    QStringList cache_urls = cache_proxies;
+    if (cache_urls.isEmpty() && roots == QStringList {"/"})
+        cache_urls << "http://localhost:3142";
+    const QString upstream = mxUpstream(mirrors, cache_urls, roots.first()); // what the caches fetch from, none if unknown
+    const QStringList caches = cacheCandidates(cache_urls, upstream, probe.proxy);
+    mirrors << caches;
+    QStringList nearby = nearbyMirrors(repos, localContinent()) + bestFromHistory(settings, mirrors, 3) + caches;
+    if (!upstream.isEmpty())
+        nearby << upstream;
+    const QList<MirrorResult> results = rankMXMirrors(&manager, &probe, mirrors, ver_name, policy, nearby);
+    const bool found = !results.isEmpty() && results.first().ok();
+    writeProbeMetrics(metrics_dir, "cli", "mx", results, found ? results.first().url : QString());
+    if (!found)
+        return QString();
+    QString url = results.first().url;
+    if (!caches.contains(url)) // a cache is kept as it is
+        url = probe.cheaperScheme(url, "/mx/repo/dists/" + ver_name + "/InRelease");
+    return url;
+}
+
+// print the parsed sources of every root, roots are read in parallel and printed in the given order
+int Cli::list(const QStringList &roots)
+{
+    const QStringList output = QtConcurrent::blockingMapped(roots, std::function<QString(const QString &)>([](const QString &root) {
+        QString text;
+        QTextStream out(&text);
+        for (const QString &file : aptFiles(root)) {
+            QFile in(file);
+            if (!in.open(QIODevice::ReadOnly | QIODevice::Text))
+                continue;
+            const QStringList lines = QString::fromUtf8(in.readAll()).split('\n');
+            for (int i = 0; i < lines.size(); ++i) {
+                const AptSource source = AptSource::parse(lines.at(i));
+                if (source.isValid())
+                    out << file << ':' << i + 1 << '\t' << (source.enabled ? "enabled" : "disabled") << '\t' << source.type
+                        << '\t' << source.uri << '\t' << source.suite << '\t' << source.components.join(' ') << '\n';
+            }
+        }
+        return text;
+    }));
+    QTextStream(stdout) << output.join(QString());
+    return EXIT_SUCCESS;
+}
+
+// enable or disable the matching sources of all roots, each root is changed in one go
+int Cli::setEnabled(const QStringList &roots, const QString &pattern, bool enable)
+{
+    const SourceFilter filter(pattern);
+    if (filter.isEmpty()) {
+        qCritical().noquote() << "Empty pattern";
+        return EXIT_FAILURE;
+    }
+    // number of changed sources (-1 if the files could not be written) and seconds for each root
+    using Result = QPair<int, double>;
+    const QList<Result> changed = QtConcurrent::blockingMapped(roots, std::function<Result(const QString &)>([&filter, enable](const QString &root) {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        const int count = setSourcesEnabled(filter, enable, root);
+        return qMakePair(count, elapsed.elapsed() / 1000.0);
+    }));
+    int failed = 0;
+    QList<ApplyMetrics> applied;
+    for (int i = 0; i < roots.size(); ++i) {
+        if (changed.at(i).first < 0) {
+            qCritical().noquote() << roots.at(i) << "could not change the sources";
+            ++failed;
+        } else {
+            qInfo().noquote() << roots.at(i) << (enable ? "enabled" : "disabled") << changed.at(i).first << "sources";
+        }
+        applied << ApplyMetrics {roots.at(i), changed.at(i).second, changed.at(i).first >= 0};
+    }
+    writeApplyMetrics(metrics_dir, "cli", applied);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int Cli::setMirror(const QStringList &roots, const QString &url)
+{
+    QHash<QString, QString> urls;
+    for (const QString &root : roots)
+        urls.insert(root, url);
+    return applyToRoots(roots, urls);
+}
+
+// switch the MX repo of all roots on the thread pool, "urls" has the mirror for each root
+int Cli::applyToRoots(const QStringList &roots, const QHash<QString, QString> &urls)
+{
+    const QList<ApplyMetrics> results = QtConcurrent::blockingMapped(roots, std::function<ApplyMetrics(const QString &)>([&urls](const QString &root) {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        ApplyMetrics apply;
+        apply.root = root;
+        apply.ok = setMXRepo(urls.value(root), root);
+        apply.seconds = elapsed.elapsed() / 1000.0;
+        return apply;
+    }));
+    writeApplyMetrics(metrics_dir, "cli", results);
+    int failed = 0;
+    for (int i = 0; i < roots.size(); ++i) {
+        if (results.at(i).ok) {
+            qInfo().noquote() << roots.at(i) << "uses" << urls.value(roots.at(i));
+        } else {
+            qCritical().noquote() << roots.at(i) << "could not change the repo";
+            ++failed;
+        }
+    }
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Re-probe the current MX mirror and the best ones according to the history kept from previous runs and
+// switch only when another mirror is faster by more than "threshold" percent for "runs" runs in a row
+int Cli::rerank(double threshold, int runs, int candidates)
+{
+    const QString ver_name = debianVerName(debianVerNum());
+    if (ver_name.isEmpty()) {
+        qCritical().noquote() << "Could not detect Debian version";
+        return EXIT_FAILURE;
+    }
+    const QStringList urls = repoUrls(readRepoList(mirror_list));
+    const QString current_host = currentMXRepo();
+    QString current;
+    for (const QString &url : urls)
+        if (mirrorHost(url) == current_host)
+            current = url;
+    if (current.isEmpty()) {
+        qInfo().noquote() << "Current mirror" << current_host << "is not in the mirror list, nothing to do";
+        return EXIT_SUCCESS;
+    }
+
+    // smoothed score per mirror host from previous runs, lower is better
+    QHash<QString, double> history;
+    settings.beginGroup("rerank/history");
+    for (const QString &host : settings.childKeys())
+        history.insert(host, settings.value(host).toDouble());
+    settings.endGroup();
+
+    QStringList probe_urls {current};
+    QMultiMap<double, QString> known;
+    for (const QString &url : urls)
+        if (history.contains(mirrorHost(url)))
+            known.insert(history.value(mirrorHost(url)), url);
+    if (known.size() < candidates) {
+        probe_urls = urls; // not enough history yet, probe everything
+    } else {
+        for (const QString &url : known.values().mid(0, candidates))
+            probe_urls << url;
+    }
+
+    MirrorProbe probe(&manager);
+    probe.timeout = probe_timeout;
+    probe.session = session;
+    probe.proxy = aptProxy();
+    const QList<MirrorResult> results = probe.run(probe_urls, "/mx/repo/dists/" + ver_name + "/InRelease");
+
+    const double alpha = 0.3;
+    const double failure_penalty = 2.0 * probe.timeout;
+    settings.beginGroup("rerank/history");
+    for (const MirrorResult &result : results) {
+        const QString host = mirrorHost(result.url);
+        const double score = result.ok() ? result.score() : failure_penalty;
+        const double smoothed = history.contains(host) ? (1 - alpha) * history.value(host) + alpha * score : score;
+        history.insert(host, smoothed);
+        settings.setValue(host, smoothed);
+        qInfo().noquote() << QString("probe %1 setup=%2ms latency=%3ms throughput=%4B/s score=%5 smoothed=%6")
+                             .arg(result.url).arg(result.setup).arg(result.latency).arg(qRound64(result.throughput)).arg(score, 0, 'f', 0).arg(smoothed, 0, 'f', 0);
+    }
+    settings.endGroup();
+
+    QString best = current;
+    for (const MirrorResult &result : results)
+        if (history.value(mirrorHost(result.url)) < history.value(mirrorHost(best)))
+            best = result.url;
+
+    const double current_score = history.value(current_host);
+    const double gain = (current_score > 0) ? 100.0 * (current_score - history.value(mirrorHost(best))) / current_score : 0;
+    int streak = 0;
+    if (best != current && gain >= threshold)
+        streak = (settings.value("rerank/candidate").toString() == best) ? settings.value("rerank/streak", 0).toInt() + 1 : 1;
+    settings.setValue("rerank/candidate", streak > 0 ? best : QString());
+    settings.setValue("rerank/streak", streak);
+
+    qInfo().noquote() << QString("current=%1 best=%2 gain=%3% threshold=%4% streak=%5/%6")
+                         .arg(current, best).arg(gain, 0, 'f', 1).arg(threshold).arg(streak).arg(runs);
+    if (streak < runs) {
+        writeProbeMetrics(metrics_dir, "cli", "mx", results, current);
+        qInfo().noquote() << "decision: keep" << current;
+        return EXIT_SUCCESS;
+    }
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    bool ok;
+    if (usesMirrorList()) {
+        QStringList ranked = urls;
+        std::sort(ranked.begin(), ranked.end(), [&history](const QString &a, const QString &b) {
+            return history.value(mirrorHost(a), std::numeric_limits<double>::max()) < history.value(mirrorHost(b), std::numeric_limits<double>::max());
+        });
+        ok = writeMXMirrorLists(ranked.mid(0, settings.value("failoverMirrors", 3).toInt()));
+    } else {
+        ok = setMXRepo(best);
+    }
+    writeApplyMetrics(metrics_dir, "cli", {{QString(), elapsed.elapsed() / 1000.0, ok}});
+    writeProbeMetrics(metrics_dir, "cli", "mx", results, ok ? best : current);
+    if (!ok) {
+        qWarning().noquote() << "decision: switch to" << best << "failed";
+        return EXIT_FAILURE;
+    }
+    settings.setValue("rerank/candidate", QString());
+    settings.setValue("rerank/streak", 0);
+    qInfo().noquote() << "decision: switched from" << current << "to" << best;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,40 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <QHash>
+#include <QNetworkAccessManager>
+#include <QSettings>
+
+#include "probesession.h"
+#include "ranking.h"
+
+// non-interactive operations, run without a display (e.g. from a systemd timer)
+class Cli : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Cli(QObject *parent = nullptr);
+
+    int exportRanking(const QString &target, const QString &network);
+    int fastest(const QStringList &roots);
+    int list(const QStringList &roots);
+    int rerank(double threshold, int runs, int candidates);
+    int setEnabled(const QStringList &roots, const QString &pattern, bool enable);
+    int setMirror(const QStringList &roots, const QString &url);
+
+    RankingPolicy policy;
+    QStringList cache_proxies; // local caches probed in proxy form, e.g. "http://cache:3142"; empty for this host's only with root "/"
+    QString metrics_dir;    // node_exporter textfile collector directory, empty for no metrics
+    QString mirror_list;    // "Country - URL" lines, repos.txt by default
+    int probe_timeout;      // ms
+
+private:
+    QString fastestFor(const QString &ver_name, const QStringList &roots);
+    int applyToRoots(const QStringList &roots, const QHash<QString, QString> &urls);
+
+    QNetworkAccessManager manager;
+    ProbeSession *session;
+    QSettings settings;
+};
+
+#endif // CLI_H
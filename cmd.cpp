@@ -32,6 +32,36 @@ QString Cmd::getCmdOut(const QString &cmd, bool quiet)
     return output;
 }
 
+// run cmd and pass every line of its output to on_line as soon as it is complete
+bool Cmd::runLines(const QString &cmd, const std::function<void(const QString &line)> &on_line, bool quiet)
+{
+    connect(this, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, &Cmd::finished, Qt::UniqueConnection);
+    if (this->state() != QProcess::NotRunning) {
+        qDebug() << "Process already running:" << this->program() << this->arguments();
+        return false;
+    }
+    if (!quiet) qDebug().noquote() << cmd;
+    QByteArray buffer;
+    auto flush = [this, &buffer, &on_line]() {
+        buffer += readAllStandardOutput();
+        int end;
+        while ((end = buffer.indexOf('\n')) >= 0) {
+            on_line(QString::fromUtf8(buffer.left(end)));
+            buffer.remove(0, end + 1);
+        }
+    };
+    QEventLoop loop;
+    connect(this, &Cmd::finished, &loop, &QEventLoop::quit, Qt::UniqueConnection);
+    const QMetaObject::Connection lines = connect(this, &QProcess::readyReadStandardOutput, this, flush);
+    start("/bin/bash", QStringList() << "-c" << cmd);
+    loop.exec();
+    disconnect(lines);
+    flush();
+    if (!buffer.trimmed().isEmpty())
+        on_line(QString::fromUtf8(buffer));
+    return (exitStatus() == QProcess::NormalExit && exitCode() == 0);
+}
+
 bool Cmd::run(const QString &cmd, QByteArray &output, bool quiet)
 {
     connect(this, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, &Cmd::finished, Qt::UniqueConnection);
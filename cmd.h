@@ -4,6 +4,8 @@
 #include <QProcess>
 #include <QString>
 
+#include <functional>
+
 class Cmd: public QProcess
 {
     Q_OBJECT
@@ -12,6 +14,7 @@ public:
     void halt();
     bool run(const QString &cmd, bool quiet = false);
     bool run(const QString &cmd, QByteArray& output, bool quiet = false);
+    bool runLines(const QString &cmd, const std::function<void(const QString &line)> &on_line, bool quiet = false);
     QString getCmdOut(const QString &cmd, bool quiet = false);
 
 signals:
@@ -23,18 +23,114 @@
  **********************************************************************/
 
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QFile>
+#include <QThread>
+#include <QThreadPool>
 #include <QTranslator>
 #include <QLibraryInfo>
 #include <QLocale>
 #include <QIcon>
 
 #include <unistd.h>
+#include "cli.h"
 #include "mainwindow.h"
 #include "version.h"
 
+// non-interactive mode, selected by "--" options, doesn't need a display
+int runCli(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationVersion(VERSION);
+    app.setOrganizationName("MX-Linux");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QObject::tr("Program for choosing the default APT repository"));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addOptions({
+        {"rerank", QObject::tr("Probe the mirrors and switch to a faster MX mirror once it has been faster for several runs (for systemd timers)")},
+        {"threshold", QObject::tr("Minimum gain over the current mirror for --rerank, in percent"), "percent", "20"},
+        {"runs", QObject::tr("Runs in a row another mirror has to be faster before --rerank switches"), "count", "3"},
+        {"candidates", QObject::tr("Number of best mirrors from previous runs that --rerank probes"), "count", "5"},
+        {"root", QObject::tr("Work on the system in this directory (e.g. a chroot), can be given several times"), "dir"},
+        {"jobs", QObject::tr("Number of roots processed in parallel"), "count", QString::number(QThread::idealThreadCount())},
+        {"list", QObject::tr("List the APT sources of every root")},
+        {"set-mirror", QObject::tr("Use this MX mirror in every root"), "url"},
+        {"enable", QObject::tr("Enable the sources matching the pattern in every root, e.g. \"suite:*-backports\" (terms uri:, suite:, component:, type:, file:)"), "pattern"},
+        {"disable", QObject::tr("Disable the sources matching the pattern in every root"), "pattern"},
+        {"fastest", QObject::tr("Probe the MX mirrors once and use the fastest in every root")},
+        {"export-ranking", QObject::tr("Probe the MX mirrors and publish the ranking to a file or http(s) URL (PUT)"), "target"},
+        {"ranking-source", QObject::tr("Use the ranking published at this file or URL instead of probing when it is fresh"), "source"},
+        {"max-age", QObject::tr("Maximum age of a shared ranking in hours"), "hours"},
+        {"network", QObject::tr("Network tag of a published ranking, only rankings with this tag are used"), "tag"},
+        {"ranking-key", QObject::tr("File with a shared secret to sign and verify rankings (HMAC-SHA256)"), "file"},
+        {"mirror-list", QObject::tr("Read the MX mirrors from this file instead of repos.txt"), "file"},
+        {"timeout", QObject::tr("Time in ms a mirror has to answer a probe"), "ms"},
+        {"target-latency", QObject::tr("Probe the mirrors outside this region only if none in it answers within this time, 0 probes all at once (default: 200)"), "ms"},
+        {"cache-proxy", QObject::tr("Local APT cache to probe alongside the mirrors, may be repeated (default: http://localhost:3142, for the running system only)"), "url"},
+        {"metrics-dir", QObject::tr("Write probe and apply metrics for the node_exporter textfile collector to this directory"), "dir"},
+    });
+    parser.process(app);
+
+    if (getuid() != 0) {
+        qCritical().noquote() << QObject::tr("You must run this program as root.");
+        return EXIT_FAILURE;
+    }
+
+    QStringList roots = parser.values("root");
+    if (roots.isEmpty())
+        roots << "/";
+    QThreadPool::globalInstance()->setMaxThreadCount(qMax(1, parser.value("jobs").toInt()));
+
+    Cli cli;
+    if (parser.isSet("target-latency"))
+        cli.policy.target_latency = parser.value("target-latency").toInt();
+    if (parser.isSet("cache-proxy"))
+        cli.cache_proxies = parser.values("cache-proxy");
+    if (parser.isSet("metrics-dir"))
+        cli.metrics_dir = parser.value("metrics-dir");
+    if (parser.isSet("mirror-list"))
+        cli.mirror_list = parser.value("mirror-list");
+    if (parser.isSet("timeout"))
+        cli.probe_timeout = parser.value("timeout").toInt();
+    if (parser.isSet("ranking-source"))
+        cli.policy.source = parser.value("ranking-source");
+    if (parser.isSet("max-age"))
+        cli.policy.max_age = parser.value("max-age").toInt();
+    if (parser.isSet("network"))
+        cli.policy.network = parser.value("network");
+    if (parser.isSet("ranking-key")) {
+        QFile key_file(parser.value("ranking-key"));
+        if (!key_file.open(QIODevice::ReadOnly)) {
+            qCritical().noquote() << QObject::tr("Could not open file: %1").arg(key_file.fileName());
+            return EXIT_FAILURE;
+        }
+        cli.policy.key = key_file.readAll().trimmed();
+    }
+    if (parser.isSet("export-ranking"))
+        return cli.exportRanking(parser.value("export-ranking"), parser.value("network"));
+    if (parser.isSet("list"))
+        return cli.list(roots);
+    if (parser.isSet("enable"))
+        return cli.setEnabled(roots, parser.value("enable"), true);
+    if (parser.isSet("disable"))
+        return cli.setEnabled(roots, parser.value("disable"), false);
+    if (parser.isSet("set-mirror"))
+        return cli.setMirror(roots, parser.value("set-mirror"));
+    if (parser.isSet("fastest"))
+        return cli.fastest(roots);
+    if (parser.isSet("rerank"))
+        return cli.rerank(parser.value("threshold").toDouble(), parser.value("runs").toInt(), parser.value("candidates").toInt());
+    parser.showHelp(EXIT_FAILURE);
+}
 
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && QByteArray(argv[1]).startsWith("--"))
+        return runCli(argc, argv);
+
     QApplication app(argc, argv);
     app.setWindowIcon(QIcon::fromTheme(app.applicationName()));
     app.setApplicationVersion(VERSION);
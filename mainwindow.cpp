@@ -25,16 +25,26 @@
 #include <QDebug>
 #include <QDesktopWidget>
 #include <QDir>
-#include <QMetaEnum>
+#include <QElapsedTimer>
 #include <QNetworkReply>
 #include <QProgressBar>
 #include <QRadioButton>
+#include <QSet>
 #include <QTemporaryDir>
 #include <QTemporaryFile>
 #include <QTextEdit>
+#include <QTreeWidgetItemIterator>
+
+#include <algorithm>
+#include <limits>
 
 #include "about.h"
+#include "aptsource.h"
 #include "mainwindow.h"
+#include "metrics.h"
+#include "mirrorprobe.h"
+#include "ranking.h"
+#include "repoconfig.h"
 #include "ui_mainwindow.h"
 
 MainWindow::MainWindow(QWidget *parent) :
@@ -55,9 +65,11 @@ MainWindow::MainWindow(QWidget *parent) :
         ui->pushFastestDebian->setIcon(QIcon::fromTheme("cursor-arrow", QIcon(":/icons/cursor-arrow.svg")));
 
     shell = new Cmd(this);
+    session = new ProbeSession(&manager, this);
 
     connect(shell, &Cmd::started, this, &MainWindow::procStart);
     connect(shell, &Cmd::finished, this, &MainWindow::procDone);
+    connect(&timer, &QTimer::timeout, this, &MainWindow::procTime);
 
     setProgressBar();
 
@@ -87,14 +99,15 @@ MainWindow::~MainWindow()
 void MainWindow::refresh()
 {
     getCurrentRepo();
+    ui->listWidget->clear(); // check the repo in use, not the one checked before
     displayMXRepos(readMXRepos(), QString());
     displayAllRepos(listAptFiles());
     ui->lineSearch->clear();
     ui->lineSearch->setFocus();
 }
 
-// replace default Debian repos
-void MainWindow::replaceDebianRepos(const QString &url)
+// replace default Debian repos, false if a file could not be backed up or changed
+bool MainWindow::replaceDebianRepos(const QString &url)
 {
     // Debian list files that are present by default in MX
     QStringList files {"/etc/apt/sources.list.d/debian.list", "/etc/apt/sources.list.d/debian-stable-updates.list"};
@@ -103,45 +116,36 @@ void MainWindow::replaceDebianRepos(const QString &url)
     if (!QFileInfo::exists("/etc/apt/sources.list.d/backups"))
         QDir().mkdir("/etc/apt/sources.list.d/backups");
 
+    bool ok = true;
     QString cmd;
     for (const QString &file : files) {
         QFileInfo fileinfo(file);
+        if (!fileinfo.exists())
+            continue;
 
         // backup file
         cmd = "cp " + file + " /etc/apt/sources.list.d/backups/" + fileinfo.fileName() + ".$(date +%s)";
-        shell->run(cmd);
+        ok = shell->run(cmd) && ok;
+
+        cmd = "sed -i 's;mirror+file:/etc/apt/mirrors/debian.list;" + url + ";' " + file; // drop failover list if used
+        ok = shell->run(cmd) && ok;
 
         cmd = "sed -i 's;deb\\s.*/debian/*[^-];deb " + url + " ;' " + file ; // replace deb lines in file
-        shell->run(cmd);
+        ok = shell->run(cmd) && ok;
         cmd = "sed -i 's;deb-src\\s.*/debian/*[^-];deb-src " + url + ";' " + file; // replace deb-src lines in file
-        shell->run(cmd);
+        ok = shell->run(cmd) && ok;
         if (url == "https://deb.debian.org/debian/") {
             cmd = "sed -i 's;deb\\s*http://security.debian.org/;deb https://deb.debian.org/debian-security/;' " + file; // replace security.debian.org in file
-            shell->run(cmd);
+            ok = shell->run(cmd) && ok;
         }
     }
-    QMessageBox::information(this, tr("Success"), tr("Your new selection will take effect the next time sources are updated."));
+    return ok;
 }
 
 // List available repos
 QStringList MainWindow::readMXRepos()
 {
-    QFile file("/usr/share/mx-repo-list/repos.txt");
-    if (!file.open(QIODevice::ReadOnly))
-        qDebug() << "Count not open file: " << file.fileName();
-
-    QString file_content = file.readAll().trimmed();
-    file.close();
-
-    QStringList file_content_list = file_content.split("\n");
-    file_content_list.sort();
-
-    // remove commented out lines
-    QStringList repos;
-    for (const QString &line : file_content_list)
-        if (!line.startsWith("#"))
-            repos << line;
-
+    const QStringList repos = readRepoList(settings.value("mirrorList", "/usr/share/mx-repo-list/repos.txt").toString());
     extractUrls(repos);
     this->repos = repos;
     return repos;
@@ -150,60 +154,65 @@ QStringList MainWindow::readMXRepos()
 // List current repo
 void MainWindow::getCurrentRepo()
 {
-    current_repo = shell->getCmdOut("grep -m1 '^deb.*/repo/ ' /etc/apt/sources.list.d/mx.list |cut -d' ' -f2 |cut -d/ -f3");
+    current_repo = currentMXRepo();
 }
 
-int MainWindow::getDebianVerNum()
-{
-    const QString out = shell->getCmdOut("cat /etc/debian_version");
-    QStringList list = out.split(".");
-    bool ok;
-    int ver = list.at(0).toInt(&ok);
-    if (ok)
-      return ver;
-    else if (list.at(0).split("/").at(0) == "bullseye")
-      return 11;
-    else if (list.at(0).split("/").at(0) == "bookworm")
-      return 12;
-    else
-      return 0; // unknown
-}
-
-QString MainWindow::getDebianVerName(int ver)
-{
-    switch (ver)
-    {
-    case 8:  return "jessie";
-    case 9:  return "stretch";
-    case 10: return "buster";
-    case 11: return "bullseye";
-    case 12: return "bookworm";
-    default:
-        qDebug() << "Could not detect Debian version";
-        exit(EXIT_FAILURE);
-    }
-}
-
-// display available repos
+// display available repos, the fastest first once they have been probed; a repo the user checked stays checked
 void MainWindow::displayMXRepos(const QStringList &repos, const QString &filter)
 {
+    QString checked;
+    for (int row = 0; row < ui->listWidget->count(); ++row)
+        if (static_cast<QRadioButton *>(ui->listWidget->itemWidget(ui->listWidget->item(row)))->isChecked())
+            checked = ui->listWidget->item(row)->data(Qt::UserRole).toString();
     ui->listWidget->clear();
-    for (const QString &repo : repos) {
+    QStringList sorted = repos;
+    if (!probe_results.isEmpty())
+        std::stable_sort(sorted.begin(), sorted.end(), [this](const QString &a, const QString &b) {
+            return probe_results.value(repoUrls({a}).at(0)).score() < probe_results.value(repoUrls({b}).at(0)).score();
+        });
+    for (const QString &repo : qAsConst(sorted)) {
         if (!filter.isEmpty() && !repo.contains(filter, Qt::CaseInsensitive))
             continue;
         QString country = repo.section("-", 0, 0).trimmed().section(",", 0, 0);
+        const QString url = repoUrls({repo}).at(0);
         QListWidgetItem *item = new QListWidgetItem(ui->listWidget);
-        QRadioButton *radio = new QRadioButton(repo);
+        item->setData(Qt::UserRole, url);
+        item->setData(Qt::UserRole + 1, repo);
+        QRadioButton *radio = new QRadioButton(repo + probeText(url));
         radio->setIcon(getFlag(country));
         ui->listWidget->setItemWidget(item, radio);
-        if (repo.contains(current_repo)) {
+        if (checked.isEmpty() ? (!current_repo.isEmpty() && repo.contains(current_repo)) : url == checked) {
             radio->setChecked(true);
             ui->listWidget->scrollToItem(item);
         }
-        connect(radio, &QRadioButton::clicked, ui->pushOk, &QPushButton::setEnabled);
+        connect(radio, &QRadioButton::clicked, this, [this]() { ui->pushOk->setEnabled(!running_probe); });
     }
 }
 
+// show a probe result in the row of its mirror without rebuilding the list, the order is updated after the probe
+void MainWindow::displayProbeResult(const MirrorResult &result)
+{
+    for (int row = 0; row < ui->listWidget->count(); ++row) {
+        QListWidgetItem *item = ui->listWidget->item(row);
+        if (item->data(Qt::UserRole).toString() == result.url)
+            static_cast<QRadioButton *>(ui->listWidget->itemWidget(item))->setText(item->data(Qt::UserRole + 1).toString() + probeText(result.url));
+    }
+}
+
+// " - 120 ms, 2 MB/s" after a repo that has been probed
+QString MainWindow::probeText(const QString &url)
+{
+    if (!probe_results.contains(url))
+        return QString();
+    const MirrorResult result = probe_results.value(url);
+    if (!result.ok())
+        return "    \u2014  " + tr("no response");
+    QString text = "    \u2014  " + tr("%1 ms, %2/s").arg(result.latency).arg(QLocale().formattedDataSize(qRound64(result.throughput)));
+    if (result.setup >= 0)
+        text += " " + tr("(connection setup %1 ms)").arg(result.setup);
+    return text;
+}
+
 void MainWindow::displayAllRepos(const QFileInfoList &apt_files)
 {
     ui->treeWidget->clear();
@@ -211,7 +220,8 @@ void MainWindow::displayAllRepos(const QFileInfoList &apt_files)
     ui->treeWidget->blockSignals(true);
     ui->treeWidgetDeb->blockSignals(true);
 
-    const QStringList columnNames {tr("Lists"), tr("Sources (checked sources are enabled)")};
+    const QStringList columnNames {tr("Lists"), tr("Sources (checked sources are enabled)"), tr("Update size"), tr("Index size"), tr("Index fetched"),
+                                   tr("Last update")};
     ui->treeWidget->setHeaderLabels(columnNames);
     ui->treeWidgetDeb->setHeaderLabels(columnNames);
 
@@ -223,6 +233,7 @@ void MainWindow::displayAllRepos(const QFileInfoList &apt_files)
         QString file = file_info.absoluteFilePath();
         topLevelItem = new QTreeWidgetItem;
         topLevelItem->setText(0, file_name);
+        topLevelItem->setData(0, Qt::UserRole, file);
         topLevelItemDeb = new QTreeWidgetItem;
         topLevelItemDeb->setText(0, file_name);
         ui->treeWidget->addTopLevelItem(topLevelItem);
@@ -252,6 +263,15 @@ void MainWindow::displayAllRepos(const QFileInfoList &apt_files)
             }
         }
     }
+    const QHash<QString, QFileInfo> lists = scanAptLists();
+    displayIndexInfo(ui->treeWidget, lists);
+    displayIndexInfo(ui->treeWidgetDeb, lists);
+    if (!update_log.isEmpty()) {
+        displayUpdateLog(ui->treeWidget);
+        displayUpdateLog(ui->treeWidgetDeb);
+    }
+    ui->pushDuplicates->setEnabled(markOverlaps(ui->treeWidget) > 0);
+
     for (int i = 0; i < ui->treeWidget->columnCount(); i++)
         ui->treeWidget->resizeColumnToContents(i);
 
@@ -260,10 +280,272 @@ void MainWindow::displayAllRepos(const QFileInfoList &apt_files)
 
     ui->treeWidget->expandAll();
     ui->treeWidgetDeb->expandAll();
+    filterSources(ui->lineFilter->text());
     ui->treeWidget->blockSignals(false);
     ui->treeWidgetDeb->blockSignals(false);
 }
 
+// size and dates of the index files apt keeps in /var/lib/apt/lists for every source: apt only replaces a file (and so
+// changes its inode change time) when it fetches a new one, and sets its modification time to the server's
+// Last-Modified, when the mirror published the index
+void MainWindow::displayIndexInfo(QTreeWidget *tree, const QHash<QString, QFileInfo> &lists)
+{
+    const QStringList archs = hostArchitectures();
+    const QDateTime now = QDateTime::currentDateTime();
+    QLocale locale;
+    for (int i = 0; i < tree->topLevelItemCount(); ++i) {
+        QTreeWidgetItem *topLevelItem = tree->topLevelItem(i);
+        qint64 file_total = 0;
+        for (int j = 0; j < topLevelItem->childCount(); ++j) {
+            QTreeWidgetItem *childItem = topLevelItem->child(j);
+            const AptSource source = AptSource::parse(childItem->text(1));
+            if (!source.isValid())
+                continue;
+            qint64 size = 0;
+            QDateTime fetched;
+            QDateTime published;
+            int found = 0;
+            for (QString name : source.listFileNames(archs)) {
+                auto it = lists.constFind(name);
+                if (it == lists.constEnd() && name.endsWith("_InRelease")) // repos without InRelease
+                    it = lists.constFind(name.replace("_InRelease", "_Release"));
+                if (it == lists.constEnd())
+                    continue;
+                ++found;
+                size += it->size();
+                if (name.endsWith("Release")) {
+                    fetched = it->metadataChangeTime();
+                    published = it->lastModified();
+                }
+            }
+            file_total += size;
+            if (found == 0) {
+                childItem->setText(3, tr("not downloaded"));
+                if (source.enabled)
+                    childItem->setForeground(3, QBrush(Qt::red));
+                continue;
+            }
+            childItem->setText(3, locale.formattedDataSize(size));
+            if (fetched.isValid()) {
+                const qint64 days = fetched.daysTo(now);
+                childItem->setText(4, locale.toString(fetched.date(), QLocale::ShortFormat) + " (" + tr("%n day(s)", nullptr, static_cast<int>(days)) + ")");
+                childItem->setToolTip(4, tr("Fetched: %1\nPublished by the mirror: %2")
+                                      .arg(locale.toString(fetched, QLocale::ShortFormat), locale.toString(published, QLocale::ShortFormat)));
+            }
+        }
+        topLevelItem->setText(3, locale.formattedDataSize(file_total));
+    }
+}
+
+// color entries that fetch what other entries fetch already, return the number of lines that can be disabled
+int MainWindow::markOverlaps(QTreeWidget *tree)
+{
+    QList<QTreeWidgetItem *> items;
+    QList<AptSource> sources;
+    for (int i = 0; i < tree->topLevelItemCount(); ++i) {
+        QTreeWidgetItem *topLevelItem = tree->topLevelItem(i);
+        const int pos = topLevelItem->text(0) == "sources.list" ? 0 : items.size(); // apt reads sources.list first
+        for (int j = topLevelItem->childCount() - 1; j >= 0; --j) {
+            items.insert(pos, topLevelItem->child(j));
+            sources.insert(pos, AptSource::parse(topLevelItem->child(j)->text(1)));
+        }
+    }
+    int redundant = 0;
+    for (const SourceOverlap &overlap : findOverlaps(sources)) {
+        QTreeWidgetItem *item = items.at(overlap.entry);
+        const QTreeWidgetItem *original = items.at(overlap.original);
+        item->setForeground(1, QBrush(Qt::darkYellow));
+        item->setData(1, Qt::UserRole, overlap.redundant);
+        if (overlap.redundant) {
+            ++redundant;
+            item->setToolTip(1, tr("Duplicate of %1 in %2, the indexes are downloaded twice").arg(original->text(1), original->parent()->text(0)));
+        } else {
+            item->setToolTip(1, tr("Components %1 are also fetched by %2 in %3").arg(overlap.shared.join(", "), original->text(1), original->parent()->text(0)));
+        }
+    }
+    return redundant;
+}
+
+// write new text for the given tree entries, all files in one go with a backup of each
+bool MainWindow::editSources(const QHash<QTreeWidgetItem *, QString> &new_texts)
+{
+    // identical lines in one file are told apart by their position among the lines with that text,
+    // counted in one pass over the entries of each file
+    QSet<QTreeWidgetItem *> parents;
+    for (auto it = new_texts.constBegin(); it != new_texts.constEnd(); ++it)
+        parents.insert(it.key()->parent());
+    QHash<QString, QHash<QString, QHash<int, QString>>> edits; // file -> line -> occurrence -> new line
+    for (QTreeWidgetItem *parent : qAsConst(parents)) {
+        QHash<QString, QHash<int, QString>> &lines = edits[parent->data(0, Qt::UserRole).toString()];
+        QHash<QString, int> seen;
+        for (int i = 0; i < parent->childCount(); ++i) {
+            QTreeWidgetItem *child = parent->child(i);
+            const QString text = child->text(1);
+            const int occurrence = seen[text]++;
+            const auto new_text = new_texts.constFind(child);
+            if (new_text != new_texts.constEnd())
+                lines[text].insert(occurrence, new_text.value());
+        }
+    }
+    if (edits.isEmpty())
+        return true;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    const auto done = [this, &elapsed](bool ok) {
+        writeApplyMetrics(settings.value("metricsDir").toString(), "gui", {{QString(), elapsed.elapsed() / 1000.0, ok}});
+        return ok;
+    };
+    int applied = 0;
+    QHash<QString, QHash<QString, int>> seen;
+    const auto edit = [&edits, &seen, &applied](const QString &file, const QString &line) {
+        const auto lines = edits.constFind(file);
+        const auto occurrences = lines->constFind(line);
+        if (occurrences == lines->constEnd())
+            return line;
+        const auto new_line = occurrences->constFind(seen[file][line]++);
+        if (new_line == occurrences->constEnd())
+            return line;
+        ++applied;
+        return new_line.value();
+    };
+    // a dry run first: every entry has to be in its file as shown, files changed in the meantime are left alone
+    const QStringList files = edits.keys();
+    for (const QString &file : files) {
+        QFile in(file);
+        if (!in.open(QIODevice::ReadOnly | QIODevice::Text))
+            return done(false);
+        for (const QString &line : QString::fromUtf8(in.readAll()).split('\n'))
+            edit(file, line);
+    }
+    if (applied != new_texts.size()) {
+        qDebug() << "Found" << applied << "of" << new_texts.size() << "source lines to change";
+        return done(false);
+    }
+    applied = 0;
+    seen.clear();
+
+    if (!QFileInfo::exists("/etc/apt/sources.list.d/backups"))
+        QDir().mkdir("/etc/apt/sources.list.d/backups");
+    for (const QString &file : files)
+        shell->run("cp " + file + " /etc/apt/sources.list.d/backups/" + QFileInfo(file).fileName() + ".$(date +%s)");
+    return done(rewriteAptFiles(files, edit) && applied == new_texts.size());
+}
+
+// write the changes queued by the checkboxes before another edit of the files, applying them later would put back
+// the lines as they were before that edit
+bool MainWindow::flushQueuedChanges()
+{
+    if (queued_changes.isEmpty() || applyChanges())
+        return true;
+    QMessageBox::critical(this, tr("Error"), tr("Could not change the repo."));
+    refresh();
+    return false;
+}
+
+// time and bytes of the last "apt-get update" per source, the time is from the first line apt printed for the source
+// until its last file was done, so sources apt reached late are not counted as slow; the slowest source is shown in bold
+void MainWindow::displayUpdateLog(QTreeWidget *tree)
+{
+    QLocale locale;
+    QTreeWidgetItem *slowest = nullptr;
+    qint64 slowest_msecs = -1;
+    for (QTreeWidgetItemIterator it(tree, QTreeWidgetItemIterator::HasNoChildren); *it; ++it) {
+        const AptSource source = AptSource::parse((*it)->text(1));
+        if (!source.isValid() || !source.enabled)
+            continue;
+        qint64 start = std::numeric_limits<qint64>::max();
+        qint64 done = 0;
+        qint64 bytes = 0;
+        int files = 0;
+        bool failed = false;
+        for (const UpdateEntry &entry : qAsConst(update_log)) {
+            if (!entry.line.matches(source))
+                continue;
+            ++files;
+            start = qMin(start, entry.start);
+            done = qMax(done, entry.done);
+            bytes += entry.line.bytes;
+            failed = failed || entry.line.status == "Err";
+        }
+        if (files == 0)
+            continue;
+        const qint64 msecs = done - start;
+        (*it)->setText(5, tr("%1 s, %2").arg(locale.toString(msecs / 1000.0, 'f', 1), locale.formattedDataSize(bytes)));
+        (*it)->setToolTip(5, tr("%n file(s) checked by the last update", nullptr, files));
+        if (failed) {
+            (*it)->setForeground(5, QBrush(Qt::red));
+            (*it)->setToolTip(5, tr("The last update could not fetch from this source"));
+        }
+        if (msecs > slowest_msecs) {
+            slowest = *it;
+            slowest_msecs = msecs;
+        }
+    }
+    if (slowest) {
+        QFont font = slowest->font(5);
+        font.setBold(true);
+        slowest->setFont(5, font);
+    }
+    tree->resizeColumnToContents(5);
+}
+
+// show only the sources matching the pattern (see SourceFilter), all of them for an empty pattern
+void MainWindow::filterSources(const QString &pattern)
+{
+    const SourceFilter filter(pattern);
+    for (int i = 0; i < ui->treeWidget->topLevelItemCount(); ++i) {
+        QTreeWidgetItem *topLevelItem = ui->treeWidget->topLevelItem(i);
+        const QString file = topLevelItem->data(0, Qt::UserRole).toString();
+        bool any = filter.isEmpty();
+        for (int j = 0; j < topLevelItem->childCount(); ++j) {
+            QTreeWidgetItem *childItem = topLevelItem->child(j);
+            const bool match = filter.isEmpty() || filter.matches(file, AptSource::parse(childItem->text(1)));
+            childItem->setHidden(!match);
+            any = any || match;
+        }
+        topLevelItem->setHidden(!any);
+    }
+    ui->pushEnableMatching->setEnabled(!filter.isEmpty());
+    ui->pushDisableMatching->setEnabled(!filter.isEmpty());
+}
+
+// enable or disable all sources shown by the filter, every file is written once
+void MainWindow::setMatchingEnabled(bool enable)
+{
+    if (!flushQueuedChanges())
+        return;
+    static const QRegularExpression comment_re("^\\s*#+\\s*");
+    QHash<QTreeWidgetItem *, QString> new_texts;
+    for (QTreeWidgetItemIterator it(ui->treeWidget, QTreeWidgetItemIterator::HasNoChildren | QTreeWidgetItemIterator::NotHidden); *it; ++it) {
+        const AptSource source = AptSource::parse((*it)->text(1));
+        if (source.isValid() && source.enabled != enable)
+            new_texts.insert(*it, enable ? QString((*it)->text(1)).remove(comment_re) : "# " + (*it)->text(1));
+    }
+    if (new_texts.isEmpty())
+        return;
+
+    if (editSources(new_texts))
+        QMessageBox::information(this, tr("Success"), (enable ? tr("%n source(s) enabled.", nullptr, new_texts.size())
+                                                              : tr("%n source(s) disabled.", nullptr, new_texts.size())) + "\n\n"
+                                 + tr("Your new selection will take effect the next time sources are updated."));
+    else
+        QMessageBox::critical(this, tr("Error"), tr("Could not change the sources, no file was modified."));
+    refresh();
+}
+
+// native architecture first, followed by the foreign ones dpkg is configured for (cached)
+QStringList MainWindow::hostArchitectures()
+{
+    if (host_archs.isEmpty()) {
+        host_archs << shell->getCmdOut("dpkg --print-architecture", true);
+        const QString foreign = shell->getCmdOut("dpkg --print-foreign-architectures", true);
+        if (!foreign.isEmpty())
+            host_archs << foreign.split("\n");
+    }
+    return host_archs;
+}
+
 QStringList MainWindow::loadAptFile(const QString &file)
 {
     QString entries = shell->getCmdOut("grep '^#*[ ]*deb' " + file);
@@ -305,25 +587,22 @@ void MainWindow::displaySelected(const QString &repo)
 // extract the URLs from the list of repos that contain country names and description
 void MainWindow::extractUrls(const QStringList &repos)
 {
-    QStringList linelist;
-    for (const QString &line : repos) {
-        linelist = line.split("-");
-        linelist.removeAt(0);
-        listMXurls += linelist.join("-").trimmed() + " "; // rejoin any repos that contain "-"
-    }
+    listMXurls = repoUrls(repos).join(" ") + " ";
 }
 
 // set the selected repo
-void MainWindow::setSelected()
+bool MainWindow::setSelected()
 {
     QString url;
+    bool ok = true;
     for (int row = 0; row < ui->listWidget->count(); ++row) {
         QRadioButton *radio = static_cast<QRadioButton*>(ui->listWidget->itemWidget(ui->listWidget->item(row)));
         if (radio->isChecked()) {
-            url = radio->text().section(" - ", 1, 1).trimmed();
-            replaceRepos(url);
+            url = ui->listWidget->item(row)->data(Qt::UserRole).toString();
+            ok = replaceRepos(url) && ok;
         }
     }
+    return ok;
 }
 
 void MainWindow::procTime()
@@ -337,55 +616,21 @@ void MainWindow::procStart()
     bar->setValue(0);
     QApplication::setOverrideCursor(QCursor(Qt::BusyCursor));
     timer.start(100);
-    connect(&timer, &QTimer::timeout, this, &MainWindow::procTime);
 }
 
 void MainWindow::procDone()
 {
     bar->setValue(100);
     timer.stop();
-    timer.disconnect();
     QApplication::setOverrideCursor(QCursor(Qt::ArrowCursor));
 }
 
 
 
 // replaces the lines in the APT file
-void MainWindow::replaceRepos(const QString &url)
+bool MainWindow::replaceRepos(const QString &url)
 {
-    QString cmd_mx;
-    QString cmd_antix;
-    QString repo_line_antix;
-
-    // get Debian version
-    const int ver_num = getDebianVerNum();
-    const QString ver_name = getDebianVerName(ver_num);
-
-    // mx source files to be edited (mx.list and mx16.list for MX15/16)
-    QString mx_file {"/etc/apt/sources.list.d/mx.list"};
-    if (QFileInfo::exists("/etc/apt/sources.list.d/mx16.list"))
-        mx_file += " /etc/apt/sources.list.d/mx16.list";       // add mx16.list to the list if it exists
-
-    // for MX repos
-    QString repo_line_mx = "deb " + url + "/mx/repo/ ";
-    QString test_line_mx = "deb " + url + "/mx/testrepo/ ";
-    cmd_mx = QString("sed -i 's;deb.*/repo/ ;%1;' %2 && ").arg(repo_line_mx, mx_file) +
-            QString("sed -i 's;deb.*/testrepo/ ;%1;' %2").arg(test_line_mx, mx_file);
-
-    if (ver_num < 9 && QFileInfo::exists("/etc/antix-version")) { // Added antix-version check in case running this on a MXfyied Debian
-        // for antiX repos
-        QString antix_file = "/etc/apt/sources.list.d/antix.list";
-        repo_line_antix = (url == "http://mxrepo.com") ? "http://la.mxrepo.com/antix/" + ver_name + "/"
-                                                       : url + "/antix/" + ver_name + "/";
-        cmd_antix = QString("sed -i 's;https\\?://.*/" + ver_name + "/\\?;%1;' %2").arg(repo_line_antix, antix_file);
-    }
-
-    // check if both replacement were successful
-    if (shell->run(cmd_mx) && (ver_num >= 9 || shell->run(cmd_antix)))
-        QMessageBox::information(this, tr("Success"), tr("Your new selection will take effect the next time sources are updated."));
-    else
-        QMessageBox::critical(this, tr("Error"), tr("Could not change the repo."));
-
+    return setMXRepo(url);
 }
 
 void MainWindow::setConnections()
@@ -393,9 +638,17 @@ void MainWindow::setConnections()
     connect(ui->lineSearch, &QLineEdit::textChanged, this, &MainWindow::lineSearch_textChanged);
     connect(ui->pb_restoreSources, &QPushButton::clicked, this, &MainWindow::pb_restoreSources_clicked);
     connect(ui->pushAbout, &QPushButton::clicked, this, &MainWindow::pushAbout_clicked);
+    connect(ui->pushDuplicates, &QPushButton::clicked, this, &MainWindow::pushDuplicates_clicked);
+    connect(ui->lineFilter, &QLineEdit::textChanged, this, &MainWindow::filterSources);
+    connect(ui->pushEnableMatching, &QPushButton::clicked, this, [this]() { setMatchingEnabled(true); });
+    connect(ui->pushDisableMatching, &QPushButton::clicked, this, [this]() { setMatchingEnabled(false); });
+    connect(ui->pushEstimate, &QPushButton::clicked, this, &MainWindow::pushEstimate_clicked);
     connect(ui->pushFastestDebian, &QPushButton::clicked, this, &MainWindow::pushFastestDebian_clicked);
+    connect(ui->pushFailover, &QPushButton::clicked, this, &MainWindow::pushFailover_clicked);
     connect(ui->pushFastestMX, &QPushButton::clicked, this, &MainWindow::pushFastestMX_clicked);
     connect(ui->pushHelp, &QPushButton::clicked, this, &MainWindow::pushHelp_clicked);
+    connect(ui->pushPrune, &QPushButton::clicked, this, &MainWindow::pushPrune_clicked);
+    connect(ui->pushUpdate, &QPushButton::clicked, this, &MainWindow::pushUpdate_clicked);
     connect(ui->pushOk, &QPushButton::clicked, this, &MainWindow::pushOk_clicked);
     connect(ui->tabWidget, &QTabWidget::currentChanged, this, &MainWindow::tabWidget_currentChanged);
     connect(ui->treeWidgetDeb, &QTreeWidget::itemChanged, this, &MainWindow::treeWidgetDeb_itemChanged);
@@ -433,19 +686,86 @@ QFileInfoList MainWindow::listAptFiles()
 // Submit button clicked
 void MainWindow::pushOk_clicked()
 {
+    if (applyChanges())
+        QMessageBox::information(this, tr("Success"), tr("Your new selection will take effect the next time sources are updated."));
+    else
+        QMessageBox::critical(this, tr("Error"), tr("Could not change the repo."));
+    refresh();
+}
+
+// write the queued changes of the sources and the selected MX repo, or "mx_url" if given instead of the selection
+bool MainWindow::applyChanges(const QString &mx_url)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+    bool ok = true;
     if (queued_changes.size() > 0) {
-        for (const QStringList &changes : qAsConst(queued_changes)) {
-            QString text, new_text, file_name;
-            text = QRegularExpression::escape(changes.at(0));
-            new_text = changes.at(1);
-            file_name = changes.at(2);
-            QString cmd = QString("sed -i 's;%1;%2;g' %3").arg(text, new_text, file_name);
-            shell->run(cmd);
+        // one write per file, changes to the same line are applied in the order they were made
+        QHash<QString, QList<QPair<QString, QString>>> changes; // file -> (text, new text)
+        QStringList files;
+        for (const QStringList &change : qAsConst(queued_changes)) {
+            if (!changes.contains(change.at(2)))
+                files << change.at(2);
+            changes[change.at(2)] << qMakePair(change.at(0).trimmed(), change.at(1));
         }
+        ok = rewriteAptFiles(files, [&changes](const QString &file, const QString &line) {
+            QString new_line = line;
+            for (const QPair<QString, QString> &change : changes.value(file))
+                if (new_line.trimmed() == change.first)
+                    new_line = change.second;
+            return new_line;
+        });
         queued_changes.clear();
     }
-    setSelected();
+    ok = (mx_url.isEmpty() ? setSelected() : replaceRepos(mx_url)) && ok;
+    writeApplyMetrics(settings.value("metricsDir").toString(), "gui", {{QString(), elapsed.elapsed() / 1000.0, ok}});
+    return ok;
+}
+
+// Apply and update button clicked: save the changes, run apt-get update and show what each source took
+void MainWindow::pushUpdate_clicked()
+{
+    if (ui->pushOk->isEnabled() && !applyChanges()) {
+        QMessageBox::critical(this, tr("Error"), tr("Could not change the repo."));
+        refresh();
+        return;
+    }
+    ui->pushOk->setDisabled(true);
+
+    // apt prints "Get" when a download starts; the files of a host come one after the other,
+    // so a file is done at the latest when the next line for its host (or the end) shows up
+    update_log.clear();
+    QHash<QString, int> downloading; // host -> "Get" line in update_log
+    QElapsedTimer elapsed;
+    progress->show();
+    elapsed.start();
+    const bool ok = shell->runLines("LANG=C apt-get update", [&](const QString &line) {
+        const UpdateLine update = UpdateLine::parse(line);
+        if (!update.isValid())
+            return;
+        const qint64 now = elapsed.elapsed();
+        const QString host = mirrorHost(update.uri);
+        if (downloading.contains(host))
+            update_log[downloading.take(host)].done = now;
+        if (update.status == "Get")
+            downloading.insert(host, update_log.size());
+        update_log << UpdateEntry {update, now, now};
+        progress->setLabelText(line);
+    });
+    for (int index : qAsConst(downloading))
+        update_log[index].done = elapsed.elapsed();
+    const qint64 total = elapsed.elapsed();
+    progress->hide();
+    progress->setLabelText(tr("Please wait..."));
+    qDebug() << "apt-get update took" << total << "ms for" << update_log.size() << "files";
+
     refresh();
+    ui->tabWidget->setCurrentWidget(ui->tabAllRepos);
+    if (ok)
+        QMessageBox::information(this, tr("Success"), tr("Sources updated in %1 s, see the 'Last update' column for each source.")
+                                 .arg(QLocale().toString(total / 1000.0, 'f', 1)));
+    else
+        QMessageBox::critical(this, tr("Error"), tr("Updating the sources failed, the sources that could not be fetched are shown in red."));
 }
 
 // About button clicked
@@ -462,6 +782,113 @@ void MainWindow::pushAbout_clicked()
     this->show();
 }
 
+// Estimate button clicked: HEAD the release and index files of every source to see what the next update downloads
+void MainWindow::pushEstimate_clicked()
+{
+    const QStringList archs = hostArchitectures();
+    QStringList urls;
+    for (QTreeWidgetItemIterator it(ui->treeWidget, QTreeWidgetItemIterator::HasNoChildren); *it; ++it) {
+        const AptSource source = AptSource::parse((*it)->text(1));
+        if (source.isValid())
+            urls << source.indexUrls(archs);
+    }
+    urls.removeDuplicates();
+
+    progress->show();
+    const QHash<QString, qint64> sizes = fetchContentLengths(urls, aptProxy());
+    progress->hide();
+
+    displayUpdateSize(ui->treeWidget, sizes, archs);
+    displayUpdateSize(ui->treeWidgetDeb, sizes, archs);
+}
+
+// Disable duplicates button clicked: comment out the lines whose indexes other lines fetch already
+void MainWindow::pushDuplicates_clicked()
+{
+    if (!flushQueuedChanges())
+        return;
+    QHash<QTreeWidgetItem *, QString> new_texts;
+    for (QTreeWidgetItemIterator it(ui->treeWidget, QTreeWidgetItemIterator::HasNoChildren); *it; ++it)
+        if ((*it)->data(1, Qt::UserRole).toBool())
+            new_texts.insert(*it, "# " + (*it)->text(1));
+    if (new_texts.isEmpty())
+        return;
+    if (QMessageBox::question(this, tr("Disable duplicates"),
+                              tr("%n source line(s) fetch indexes that other lines fetch already. Disable them?", nullptr, new_texts.size()))
+            != QMessageBox::Yes)
+        return;
+
+    if (editSources(new_texts))
+        QMessageBox::information(this, tr("Success"), tr("Your new selection will take effect the next time sources are updated."));
+    else
+        QMessageBox::critical(this, tr("Error"), tr("Could not change the sources, no file was modified."));
+    refresh();
+}
+
+// Prune button clicked: disable deb-src lines when nothing builds from source and keep "arch=" lines
+// from fetching indexes of foreign architectures that have no installed packages
+void MainWindow::pushPrune_clicked()
+{
+    if (!flushQueuedChanges())
+        return;
+    const QStringList archs = hostArchitectures();
+    const QStringList installed = shell->getCmdOut("dpkg-query -W -f='${Architecture}\\n' | sort -u", true).split("\n");
+    QStringList keep_archs {archs.value(0)};
+    for (const QString &arch : archs.mid(1))
+        if (installed.contains(arch))
+            keep_archs << arch;
+    // apt-get source and build-dep are of little use without dpkg-dev
+    const bool need_src = shell->run("dpkg-query -W -f='${Status}' dpkg-dev 2>/dev/null | grep -q 'ok installed'", true);
+
+    const QHash<QString, QFileInfo> lists = scanAptLists();
+    QHash<QTreeWidgetItem *, QString> new_texts;
+    QSet<QString> dropped;
+    qint64 saved = 0;
+    QStringList report;
+    for (QTreeWidgetItemIterator it(ui->treeWidget, QTreeWidgetItemIterator::HasNoChildren); *it; ++it) {
+        const AptSource source = AptSource::parse((*it)->text(1));
+        if (!source.isValid() || !source.enabled)
+            continue;
+        QStringList unused;
+        if (source.type == "deb-src" && !need_src) {
+            new_texts.insert(*it, "# " + (*it)->text(1));
+            unused = source.listFileNames(archs).mid(1); // the Release file is shared with the deb line
+        } else if (source.type == "deb" && keep_archs.size() < archs.size() && source.architectures(archs) == archs) {
+            new_texts.insert(*it, source.withArchitectures(keep_archs));
+            const QStringList kept = source.listFileNames(keep_archs);
+            for (const QString &name : source.listFileNames(archs))
+                if (!kept.contains(name))
+                    unused << name;
+        } else {
+            continue;
+        }
+        for (const QString &name : qAsConst(unused)) {
+            if (!dropped.contains(name) && lists.contains(name))
+                saved += lists.value(name).size();
+            dropped.insert(name);
+        }
+        report << (*it)->parent()->text(0) + ": " + new_texts.value(*it);
+    }
+    if (new_texts.isEmpty()) {
+        QMessageBox::information(this, tr("Prune indexes"), tr("All enabled sources fetch only indexes this system uses."));
+        return;
+    }
+
+    QMessageBox box(QMessageBox::Question, tr("Prune indexes"),
+                    tr("%n source line(s) download indexes this system doesn't use, about %1 per update. Change them?", nullptr, new_texts.size())
+                    .arg(QLocale().formattedDataSize(saved)),
+                    QMessageBox::Yes | QMessageBox::No, this);
+    box.setDetailedText(report.join("\n"));
+    if (box.exec() != QMessageBox::Yes)
+        return;
+
+    if (editSources(new_texts))
+        QMessageBox::information(this, tr("Success"), tr("Your new selection will take effect the next time sources are updated."));
+    else
+        QMessageBox::critical(this, tr("Error"), tr("Could not change the sources, no file was modified."));
+    refresh();
+}
+
 // Help button clicked
 void MainWindow::pushHelp_clicked()
 {
@@ -477,7 +904,7 @@ void MainWindow::pushHelp_clicked()
 
 void MainWindow::treeWidget_itemChanged(QTreeWidgetItem * item, int column)
 {
-    ui->pushOk->setEnabled(true);
+    ui->pushOk->setEnabled(!running_probe);
     ui->treeWidget->blockSignals(true);
     if (item->text(column).contains("/mx/testrepo/") && item->checkState(column) == Qt::Checked)
         QMessageBox::warning(this, tr("Warning"),
@@ -509,7 +936,7 @@ void MainWindow::treeWidget_itemChanged(QTreeWidgetItem * item, int column)
 
 void MainWindow::treeWidgetDeb_itemChanged(QTreeWidgetItem *item, int column)
 {
-    ui->pushOk->setEnabled(true);
+    ui->pushOk->setEnabled(!running_probe);
     ui->treeWidgetDeb->blockSignals(true);
     QFile file;
     QString new_text;
@@ -542,42 +969,102 @@ void MainWindow::tabWidget_currentChanged()
         ui->label->setText(tr("Select the APT repository and sources that you want to use:"));
 }
 
-// Transform "country" name to 2-3 letter ISO 3166 country code and provide the QIcon for it
+// provide the flag QIcon for a "country" name
 QIcon MainWindow::getFlag(QString country)
 {
-    QMetaObject metaObject = QLocale::staticMetaObject;
-    QMetaEnum metaEnum = metaObject.enumerator(metaObject.indexOfEnumerator("Country"));
-    // fix flag of the Netherlands: QLocale::Netherlands
-    if (country == QLatin1String("The Netherlands"))
-        country = QStringLiteral("Netherlands");
-    // fix flag of the United States of America: QLocale::UnitedStates
-    if (country == QLatin1String("USA"))
-        country = QStringLiteral("UnitedStates");
+    const QString code = getCountryCode(country);
+    if (code.isEmpty())
+        return QIcon();
+    return QIcon("/usr/share/flags-common/" + code + ".png");
+}
+
+// Transform "country" name to 2-3 letter ISO 3166 country code, "any" for worldwide mirrors
+QString MainWindow::getCountryCode(QString country)
+{
     if (country == QLatin1String("Anycast") || country == QLatin1String("Any") || country == QLatin1String("World"))
-        return QIcon("/usr/share/flags-common/any.png");
+        return QStringLiteral("any");
 
-    // QMetaEnum metaEnum = QMetaEnum::fromType<QLocale::Country>(); -- not in older Qt versions
-    int index = metaEnum.keyToValue(country.remove(" ").toUtf8());
-    QList<QLocale> locales = QLocale::matchingLocales(QLocale::AnyLanguage, QLocale::AnyScript, QLocale::Country(index));
+    const QLocale::Country index = countryByName(country);
+    if (index == QLocale::AnyCountry)
+        return QString();
+    QList<QLocale> locales = QLocale::matchingLocales(QLocale::AnyLanguage, QLocale::AnyScript, index);
     // qDebug() << "etFlag county: " << country << " locales: " << locales;
-    if (locales.length() > 0) {
-        QString short_name = locales.at(0).name().section("_", 1, 1).toLower();
-        return QIcon("/usr/share/flags-common/" + short_name + ".png");
-    }
-    return QIcon();
+    if (locales.length() > 0)
+        return locales.at(0).name().section("_", 1, 1).toLower();
+    return QString();
 }
 
 // detect fastest Debian repo
 void MainWindow::pushFastestDebian_clicked()
+{
+    if (running_probe) { // clicked again while probing: take the best so far
+        running_probe->cancel();
+        return;
+    }
+    const QString ver_name = debianVerName(debianVerNum());
+    if (ver_name.isEmpty()) {
+        QMessageBox::critical(this, tr("Error"), tr("Could not detect Debian version."));
+        return;
+    }
+    const QString proxy = aptProxy();
+    QStringList mirrors = debianMirrors();
+    // the caches fetch from the mirror in use, or from the one behind the cache in use; none if that is unknown
+    mirrors << cacheCandidates(cacheProxies(), cacheUpstream(cacheProxies(), mirrors.value(0)), proxy);
+    const QList<MirrorResult> ranked = probeWithProgress(ui->pushFastestDebian, mirrors.size(), proxy, [&](MirrorProbe *probe) {
+        return probe->run(mirrors, "dists/" + ver_name + "/InRelease");
+    });
+    if (probe_canceled)
+        return;
+
+    QString repo = (!ranked.isEmpty() && ranked.first().ok()) ? ranked.first().url : netselectDebianRepo();
+    writeProbeMetrics(settings.value("metricsDir").toString(), "gui", "debian", ranked, repo);
+    if (!repo.isEmpty())
+        repo = cheaperScheme(repo, "dists/" + ver_name + "/InRelease", proxy);
+    if (!repo.isEmpty() && checkRepo(repo, proxy)) {
+        QElapsedTimer elapsed;
+        elapsed.start();
+        const bool ok = replaceDebianRepos(repo);
+        writeApplyMetrics(settings.value("metricsDir").toString(), "gui", {{QString(), elapsed.elapsed() / 1000.0, ok}});
+        if (ok)
+            QMessageBox::information(this, tr("Success"), tr("Your new selection will take effect the next time sources are updated."));
+        else
+            QMessageBox::critical(this, tr("Error"), tr("Could not change the repo."));
+        refresh();
+    } else {
+        QMessageBox::critical(this, tr("Error"), tr("Could not detect fastest repo."));
+    }
+}
+
+// time the mirror over http and https with new connections and return it with the cheaper scheme,
+// local caches in proxy form are left alone, so are all mirrors when APT uses a proxy (see MirrorProbe::cheaperScheme())
+QString MainWindow::cheaperScheme(const QString &mirror, const QString &path, const QString &proxy)
+{
+    for (const QString &cache : cacheProxies())
+        if (mirror.startsWith(cache))
+            return mirror;
+    MirrorProbe probe(&manager);
+    probe.timeout = settings.value("probeTimeout", 5000).toInt();
+    probe.proxy = proxy;
+    progress->setLabelText(tr("Comparing http and https for %1").arg(mirrorHost(mirror)));
+    progress->show();
+    const QString url = probe.cheaperScheme(mirror, path);
+    progress->hide();
+    progress->setLabelText(tr("Please wait..."));
+    return url;
+}
+
+// ask netselect-apt when none of our Debian candidates answered
+QString MainWindow::netselectDebianRepo()
 {
     progress->show();
     QTemporaryFile tmpfile;
     if (!tmpfile.open()) {
         qDebug() << "Could not create temp file";
-        return;
+        progress->hide();
+        return QString();
     }
 
-    QString ver_name {getDebianVerName(getDebianVerNum())};
+    QString ver_name {debianVerName(debianVerNum())};
     if (ver_name == "buster" || ver_name == "bullseye") ver_name = QString(); // netselect-apt doesn't like name buster/bullseye for some reason, maybe it expects "stable"
 
     QByteArray out;
@@ -585,35 +1072,204 @@ void MainWindow::pushFastestDebian_clicked()
     progress->hide();
 
     if (!success) {
-        QMessageBox::critical(this, tr("Error"), tr("netselect-apt could not detect fastest repo."));
-        return;
+        qDebug() << "netselect-apt could not detect fastest repo";
+        return QString();
     }
-    QString repo = shell->getCmdOut("set -o pipefail; grep -m1 '^deb ' " + tmpfile.fileName() + "| cut -d' ' -f2");
-    this->blockSignals(false);
+    return shell->getCmdOut("set -o pipefail; grep -m1 '^deb ' " + tmpfile.fileName() + "| cut -d' ' -f2");
+}
 
-    if (success && checkRepo(repo)) {
-        replaceDebianRepos(repo);
+// detect and select the fastest MX repo, from the shared ranking if one is configured
+void MainWindow::pushFastestMX_clicked()
+{
+    if (running_probe) { // clicked again while probing: take the best so far
+        running_probe->cancel();
+        return;
+    }
+    const QString ver_name = debianVerName(debianVerNum());
+    if (ver_name.isEmpty()) {
+        QMessageBox::critical(this, tr("Error"), tr("Could not detect Debian version."));
+        return;
+    }
+    QStringList mirrors = listMXurls.simplified().split(" ");
+    const QString upstream = mxUpstream(mirrors, cacheProxies()); // what the caches fetch from, none if unknown
+    const QString proxy = aptProxy();
+    const QStringList caches = cacheCandidates(cacheProxies(), upstream, proxy);
+    mirrors << caches;
+    const RankingPolicy policy = RankingPolicy::fromSettings(settings);
+    // mirrors in this region, the best ones of earlier runs, the one in use and the local caches first
+    QStringList nearby = nearbyMirrors(repos, localContinent()) + bestFromHistory(settings, mirrors, 3) + caches;
+    for (const MirrorResult &result : qAsConst(probe_results))
+        if (result.ok() && result.latency <= policy.target_latency)
+            nearby << result.url;
+    if (!upstream.isEmpty())
+        nearby << upstream;
+    probe_results.clear();
+    displayMXRepos(repos, ui->lineSearch->text());
+    QElapsedTimer elapsed;
+    elapsed.start();
+    const QList<MirrorResult> ranked = probeWithProgress(ui->pushFastestMX, mirrors.size(), proxy, [&](MirrorProbe *probe) {
+        return rankMXMirrors(&manager, probe, mirrors, ver_name, policy, nearby);
+    });
+    qDebug() << "Probed" << ranked.size() << "of" << mirrors.size() << "mirrors in" << elapsed.elapsed() << "ms";
+    displayMXRepos(repos, ui->lineSearch->text()); // fastest first
+    if (probe_canceled)
+        return;
+    writeProbeMetrics(settings.value("metricsDir").toString(), "gui", "mx", ranked, (!ranked.isEmpty() && ranked.first().ok()) ? ranked.first().url : QString());
+    if (!ranked.isEmpty() && ranked.first().ok() && caches.contains(ranked.first().url)) {
+        qDebug() << "FASTEST is a local cache" << ranked.first().url << ranked.first().latency << "ms";
+        if (applyChanges(ranked.first().url))
+            QMessageBox::information(this, tr("Success"), tr("The local APT cache %1 was fastest, it is used from now on.").arg(mirrorHost(ranked.first().url)) + "\n\n"
+                                     + tr("Your new selection will take effect the next time sources are updated."));
+        else
+            QMessageBox::critical(this, tr("Error"), tr("Could not change the repo."));
+        refresh();
+    } else if (!ranked.isEmpty() && ranked.first().ok()) {
+        qDebug() << "FASTEST " << ranked.first().url << ranked.first().latency << "ms";
+        const QString url = cheaperScheme(ranked.first().url, "/mx/repo/dists/" + ver_name + "/InRelease", proxy);
+        if (url == ranked.first().url) {
+            displaySelected(url);
+            pushOk_clicked();
+            return;
+        }
+        if (applyChanges(url))
+            QMessageBox::information(this, tr("Success"), tr("%1 is fastest and costs less over %2, it is used as %3.").arg(mirrorHost(url), QUrl(url).scheme(), url) + "\n\n"
+                                     + tr("Your new selection will take effect the next time sources are updated."));
+        else
+            QMessageBox::critical(this, tr("Error"), tr("Could not change the repo."));
         refresh();
     } else {
         QMessageBox::critical(this, tr("Error"), tr("Could not detect fastest repo."));
     }
 }
 
-// detect and select the fastest MX repo
-void MainWindow::pushFastestMX_clicked()
+// Run a probe with live progress. Results show up as they arrive (MX probes also in the rows of the MX list),
+// clicking the button that started the probe again stops it and keeps the best so far, Cancel drops everything.
+// http probes go through "proxy", APT's proxy as found by aptProxy().
+QList<MirrorResult> MainWindow::probeWithProgress(QPushButton *button, int total, const QString &proxy,
+                                                  const std::function<QList<MirrorResult>(MirrorProbe *)> &run)
 {
+    MirrorProbe probe(&manager);
+    probe.timeout = settings.value("probeTimeout", 5000).toInt();
+    probe.proxy = proxy;
+    probe.session = session;
+    running_probe = &probe;
+    probe_canceled = false;
+
+    int done = 0;
+    MirrorResult leader;
+    connect(&probe, &MirrorProbe::resultReady, this, [&](const MirrorResult &result) {
+        ++done;
+        if (result.score() < leader.score())
+            leader = result;
+        bar->setValue(done);
+        QString text = tr("Probed %1 of %2 mirrors").arg(done).arg(total);
+        if (leader.ok())
+            text += "\n" + tr("Fastest so far: %1 (%2 ms)").arg(leader.url).arg(leader.latency);
+        progress->setLabelText(text);
+        if (button == ui->pushFastestMX) {
+            probe_results.insert(result.url, result);
+            displayProbeResult(result);
+        }
+    });
+    connect(progCancel, &QPushButton::clicked, &probe, [this, &probe]() {
+        probe_canceled = true;
+        probe.cancel();
+    });
+
+    // only the MX list and the button that started the probe stay usable,
+    // the other actions would start another probe or write the sources while this one runs
+    QList<QWidget *> disabled;
+    for (QWidget *widget : QList<QWidget *> {ui->tabDebian, ui->tabAllRepos, ui->pushFastestMX, ui->pushFailover, ui->pushUpdate, ui->pushOk}) {
+        if (widget->isEnabled() && widget != button && !widget->isAncestorOf(button)) {
+            widget->setEnabled(false);
+            disabled << widget;
+        }
+    }
+    const QString button_text = button->text();
+    button->setText(tr("Use fastest so far"));
+    bar->setMaximum(qMax(1, total));
+    bar->setValue(0);
+    progress->setLabelText(tr("Probed %1 of %2 mirrors").arg(0).arg(total));
+    progress->setWindowModality(Qt::NonModal); // keep the list and the button usable
     progress->show();
-    QByteArray out;
-    bool success = shell->run("set -o pipefail; netselect -D -I " + listMXurls + " |tr -s ' ' |sed 's/^ //' |cut -d' ' -f2", out);
-    qDebug() << listMXurls;
-    qDebug() << "FASTEST " << success << out;
+
+    QList<MirrorResult> results = run(&probe);
+
     progress->hide();
-    if (success && !out.isEmpty()) {
-        displaySelected(out);
-        pushOk_clicked();
-    } else {
+    progress->setWindowModality(Qt::WindowModal);
+    progress->setLabelText(tr("Please wait..."));
+    bar->setMaximum(100);
+    button->setText(button_text);
+    running_probe = nullptr;
+    for (QWidget *widget : qAsConst(disabled))
+        widget->setEnabled(true);
+    // changes made while probing can be applied now
+    bool changed = !queued_changes.isEmpty();
+    for (int row = 0; row < ui->listWidget->count(); ++row) {
+        QListWidgetItem *item = ui->listWidget->item(row);
+        if (static_cast<QRadioButton *>(ui->listWidget->itemWidget(item))->isChecked())
+            changed = changed || mirrorHost(item->data(Qt::UserRole).toString()) != current_repo;
+    }
+    if (changed)
+        ui->pushOk->setEnabled(true);
+    if (probe_canceled)
+        results.clear();
+    return results;
+}
+
+// probe MX and Debian mirrors and switch to failover lists of the best ones
+void MainWindow::pushFailover_clicked()
+{
+    if (running_probe) {
+        running_probe->cancel();
+        return;
+    }
+    const int count = settings.value("failoverMirrors", 3).toInt();
+    const QString ver_name = debianVerName(debianVerNum());
+    if (ver_name.isEmpty()) {
+        QMessageBox::critical(this, tr("Error"), tr("Could not detect Debian version."));
+        return;
+    }
+    const QString proxy = aptProxy();
+    const QStringList mx_candidates = listMXurls.simplified().split(" ");
+    const QList<MirrorResult> mx_ranked = probeWithProgress(ui->pushFailover, mx_candidates.size(), proxy, [&](MirrorProbe *probe) {
+        return probe->run(mx_candidates, "/mx/repo/dists/" + ver_name + "/InRelease");
+    });
+    if (probe_canceled)
+        return;
+    const QStringList debian_candidates = debianMirrors();
+    const QList<MirrorResult> debian_ranked = probeWithProgress(ui->pushFailover, debian_candidates.size(), proxy, [&](MirrorProbe *probe) {
+        return probe->run(debian_candidates, "dists/" + ver_name + "/InRelease");
+    });
+    if (probe_canceled)
+        return;
+
+    QStringList mx_mirrors;
+    QStringList debian_mirrors;
+    for (const MirrorResult &result : mx_ranked)
+        if (result.ok() && mx_mirrors.size() < count)
+            mx_mirrors << result.url;
+    for (const MirrorResult &result : debian_ranked)
+        if (result.ok() && debian_mirrors.size() < count)
+            debian_mirrors << result.url;
+    qDebug() << "Failover MX:" << mx_mirrors << "Debian:" << debian_mirrors;
+
+    if (mx_mirrors.isEmpty()) {
         QMessageBox::critical(this, tr("Error"), tr("Could not detect fastest repo."));
+        return;
     }
+    const QString metrics_dir = settings.value("metricsDir").toString();
+    writeProbeMetrics(metrics_dir, "gui", "mx", mx_ranked, mx_mirrors.value(0));
+    writeProbeMetrics(metrics_dir, "gui", "debian", debian_ranked, debian_mirrors.value(0));
+    QElapsedTimer elapsed;
+    elapsed.start();
+    const bool ok = useMirrorLists(mx_mirrors, debian_mirrors);
+    writeApplyMetrics(metrics_dir, "gui", {{QString(), elapsed.elapsed() / 1000.0, ok}});
+    if (ok)
+        QMessageBox::information(this, tr("Success"), tr("Your new selection will take effect the next time sources are updated."));
+    else
+        QMessageBox::critical(this, tr("Error"), tr("Could not change the repo."));
+    refresh();
 }
 
 //void MainWindow::pushRedirector_clicked()
@@ -680,12 +1336,13 @@ void MainWindow::pb_restoreSources_clicked()
                              tr("Your new selection will take effect the next time sources are updated."));
 }
 
-bool MainWindow::checkRepo(const QString &repo)
+// the repo answers, through APT's proxy ("proxy") if it uses one
+bool MainWindow::checkRepo(const QString &repo, const QString &proxy)
 {
-    QNetworkRequest request;
-    request.setRawHeader("User-Agent", qApp->applicationName().toUtf8() + "/" + qApp->applicationVersion().toUtf8() + " (linux-gnu)");
-    request.setUrl(QUrl(repo));
-    reply = manager.head(request);
+    const QNetworkRequest request = appRequest(repo);
+    QNetworkAccessManager proxied;
+    useAptProxy(&proxied, proxy);
+    reply = (proxy.isEmpty() ? manager : proxied).head(request);
 
     auto error {QNetworkReply::NoError};
     QEventLoop loop;
@@ -701,31 +1358,182 @@ bool MainWindow::checkRepo(const QString &repo)
     return false;
 }
 
-bool MainWindow::downloadFile(const QString &url, QFile &file)
+// local APT caches to try in proxy form, apt-cacher-ng's port on this host by default
+QStringList MainWindow::cacheProxies()
 {
-    if (!file.open(QIODevice::WriteOnly)) {
-        qDebug() << "Could not open file:" << file.fileName();
+    return settings.value("cacheProxies", QStringList {"http://localhost:3142"}).toStringList();
+}
+
+// Debian candidates: the mirror in use, the redirector and the Debian mirrors of the countries with MX mirrors
+QStringList MainWindow::debianMirrors()
+{
+    QStringList mirrors;
+    for (const QString &line : loadAptFile("/etc/apt/sources.list.d/debian.list")) {
+        const AptSource source = AptSource::parse(line);
+        if (source.enabled && source.type == "deb" && source.uri.startsWith("http") && source.uri.contains(QRegularExpression("/debian/?$"))) {
+            mirrors << source.baseUri();
+            break;
+        }
+    }
+    mirrors << "http://deb.debian.org/debian/";
+    for (const QString &repo : qAsConst(repos)) {
+        QString code = getCountryCode(repo.section("-", 0, 0).trimmed().section(",", 0, 0));
+        if (code == "gb")
+            code = "uk";
+        if (!code.isEmpty() && code != "any")
+            mirrors << "http://ftp." + code + ".debian.org/debian/";
+    }
+    mirrors.removeDuplicates();
+    return mirrors;
+}
+
+// point the MX and Debian lines to "mirror+file:" lists, APT then tries the mirrors in order of priority
+bool MainWindow::useMirrorLists(const QStringList &mx_mirrors, const QStringList &debian_mirrors)
+{
+    const QString mirror_dir {"/etc/apt/mirrors"};
+    if (!QDir().mkpath(mirror_dir))
         return false;
+
+    if (!writeMXMirrorLists(mx_mirrors))
+        return false;
+
+    QStringList mx_files {"/etc/apt/sources.list.d/mx.list"};
+    if (QFileInfo::exists("/etc/apt/sources.list.d/mx16.list"))
+        mx_files << "/etc/apt/sources.list.d/mx16.list";
+    for (const QString &file : mx_files) {
+        bool ok = rewriteAptFile(file, [&mirror_dir](const QString &line) {
+            const AptSource source = AptSource::parse(line);
+            if (source.uri.contains(QRegularExpression("/mx/repo/?$")))
+                return QString(line).replace(source.uri, "mirror+file:" + mirror_dir + "/mx-repo.list");
+            if (source.uri.contains(QRegularExpression("/mx/testrepo/?$")))
+                return QString(line).replace(source.uri, "mirror+file:" + mirror_dir + "/mx-testrepo.list");
+            return line;
+        });
+        if (!ok)
+            return false;
     }
 
-    QNetworkRequest request;
-    request.setRawHeader("User-Agent", qApp->applicationName().toUtf8() + "/" + qApp->applicationVersion().toUtf8() + " (linux-gnu)");
-    request.setUrl(QUrl(url));
+    if (debian_mirrors.isEmpty())
+        return true;
+    if (!writeMirrorList(mirror_dir + "/debian.list", debian_mirrors))
+        return false;
 
-    reply = manager.get(request);
-    QEventLoop loop;
+    if (!QFileInfo::exists("/etc/apt/sources.list.d/backups"))
+        QDir().mkdir("/etc/apt/sources.list.d/backups");
+    const QStringList debian_files {"/etc/apt/sources.list.d/debian.list", "/etc/apt/sources.list.d/debian-stable-updates.list"};
+    for (const QString &file : debian_files) {
+        if (!QFileInfo::exists(file))
+            continue;
+        shell->run("cp " + file + " /etc/apt/sources.list.d/backups/" + QFileInfo(file).fileName() + ".$(date +%s)");
+        bool ok = rewriteAptFile(file, [&mirror_dir](const QString &line) {
+            const AptSource source = AptSource::parse(line);
+            if (source.uri.startsWith("http") && source.uri.contains(QRegularExpression("/debian/?$")))
+                return QString(line).replace(source.uri, "mirror+file:" + mirror_dir + "/debian.list");
+            return line;
+        });
+        if (!ok)
+            return false;
+    }
+    return true;
+}
 
-    bool success = true;
-    connect(reply, &QNetworkReply::readyRead, [this, &file, &success]() { success = file.write(reply->readAll()); });
-    connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+// send HEAD requests for all URLs at once (through APT's proxy "proxy" if it uses one), return Content-Length of
+// those that answered
+QHash<QString, qint64> MainWindow::fetchContentLengths(const QStringList &urls, const QString &proxy)
+{
+    QHash<QString, qint64> sizes;
+    if (urls.isEmpty())
+        return sizes;
+
+    // resolve the hosts together first, but don't let a slow resolver hold up the estimate; a proxy resolves for us
+    QNetworkAccessManager proxied;
+    useAptProxy(&proxied, proxy);
+    QNetworkAccessManager &used = proxy.isEmpty() ? manager : proxied;
+    if (proxy.isEmpty())
+        session->prepare(urls, 1000);
+    QEventLoop loop;
+    int pending = urls.size();
+    QList<QNetworkReply *> replies;
+    for (const QString &url : urls) {
+        QNetworkRequest request = appRequest(url);
+        request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+        QNetworkReply *head = used.head(request);
+        replies << head;
+        connect(head, &QNetworkReply::finished, &loop, [head, url, &sizes, &pending, &loop]() {
+            const QVariant length = head->header(QNetworkRequest::ContentLengthHeader);
+            if (head->error() == QNetworkReply::NoError && length.isValid())
+                sizes.insert(url, length.toLongLong());
+            if (--pending == 0)
+                loop.quit();
+        });
+    }
+    connect(progCancel, &QPushButton::clicked, &loop, &QEventLoop::quit);
+    QTimer::singleShot(15000, &loop, &QEventLoop::quit);
     loop.exec();
-    reply->disconnect();
 
-    if (!success) {
+    for (QNetworkReply *head : qAsConst(replies)) {
+        head->disconnect();
+        head->abort();
+        head->deleteLater();
+    }
+    qDebug() << "Sizes received for" << sizes.size() << "of" << urls.size() << "index files";
+    return sizes;
+}
+
+// show bytes per source, per file and in total; files shared by several lines (e.g. InRelease) are counted once
+void MainWindow::displayUpdateSize(QTreeWidget *tree, const QHash<QString, qint64> &sizes, const QStringList &archs)
+{
+    tree->blockSignals(true);
+    QLocale locale;
+    QSet<QString> counted;
+    qint64 total = 0;
+    for (int i = 0; i < tree->topLevelItemCount(); ++i) {
+        QTreeWidgetItem *topLevelItem = tree->topLevelItem(i);
+        qint64 file_total = 0;
+        for (int j = 0; j < topLevelItem->childCount(); ++j) {
+            QTreeWidgetItem *childItem = topLevelItem->child(j);
+            const AptSource source = AptSource::parse(childItem->text(1));
+            if (!source.isValid())
+                continue;
+            qint64 bytes = 0;
+            bool complete = true;
+            for (const QString &url : source.indexUrls(archs)) {
+                if (!sizes.contains(url)) {
+                    complete = false;
+                    continue;
+                }
+                bytes += sizes.value(url);
+                if (childItem->checkState(1) == Qt::Checked && !counted.contains(url)) {
+                    counted.insert(url);
+                    file_total += sizes.value(url);
+                }
+            }
+            childItem->setText(2, locale.formattedDataSize(bytes) + (complete ? QString() : QStringLiteral(" (?)")));
+            if (!complete)
+                childItem->setToolTip(2, tr("Some index files did not answer, the size is incomplete"));
+        }
+        topLevelItem->setText(2, locale.formattedDataSize(file_total));
+        total += file_total;
+    }
+    tree->headerItem()->setText(2, tr("Update size (enabled: %1)").arg(locale.formattedDataSize(total)));
+    tree->resizeColumnToContents(2);
+    tree->blockSignals(false);
+}
+
+bool MainWindow::downloadFile(const QString &url, QFile &file)
+{
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Could not open file:" << file.fileName();
+        return false;
+    }
+
+    bool write_error = false;
+    const bool ok = fetchFile(&manager, url, &file, settings.value("stallTimeout", 30000).toInt(), &write_error);
+    if (write_error) {
         QMessageBox::warning(this, tr("Error"), tr("There was an error writing file: %1. Please check if you have enough free space on your drive").arg(file.fileName()));
         exit(EXIT_FAILURE);
     }
 
     file.close();
-    return (reply->error() == QNetworkReply::NoError);
+    return ok;
 }
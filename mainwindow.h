@@ -35,7 +35,12 @@
 #include <QTimer>
 #include <QTreeWidget>
 
+#include "aptsource.h"
 #include "cmd.h"
+#include "mirrorprobe.h"
+#include "probesession.h"
+
+#include <functional>
 
 
 namespace Ui {
@@ -52,29 +57,47 @@ public:
 
     QFileInfoList listAptFiles();
     QIcon getFlag(QString country);
+    QString getCountryCode(QString country);
     QList<QStringList> queued_changes;
-    QString getDebianVerName(int ver);
     QString listMXurls;
     QString version;
+    QHash<QString, qint64> fetchContentLengths(const QStringList &urls, const QString &proxy);
+    QList<MirrorResult> probeWithProgress(QPushButton *button, int total, const QString &proxy, const std::function<QList<MirrorResult>(MirrorProbe *)> &run);
+    QString cheaperScheme(const QString &mirror, const QString &path, const QString &proxy);
+    QString probeText(const QString &url);
+    QString netselectDebianRepo();
     QStringList loadAptFile(const QString &file);
+    QStringList cacheProxies();
+    QStringList debianMirrors();
+    QStringList hostArchitectures();
     QStringList readMXRepos();
-    int getDebianVerNum();
+    bool applyChanges(const QString &mx_url = QString());
+    bool editSources(const QHash<QTreeWidgetItem *, QString> &new_texts);
+    bool flushQueuedChanges();
+    bool useMirrorLists(const QStringList &mx_mirrors, const QStringList &debian_mirrors);
+    int markOverlaps(QTreeWidget *tree);
     void centerWindow();
     void displayAllRepos(const QFileInfoList &apt_files);
+    void displayIndexInfo(QTreeWidget *tree, const QHash<QString, QFileInfo> &lists);
     void displayMXRepos(const QStringList &repos, const QString &filter);
+    void displayProbeResult(const MirrorResult &result);
     void displaySelected(const QString &repo);
+    void displayUpdateLog(QTreeWidget *tree);
+    void displayUpdateSize(QTreeWidget *tree, const QHash<QString, qint64> &sizes, const QStringList &archs);
     void extractUrls(const QStringList &repos);
     void getCurrentRepo();
     void refresh();
-    void replaceDebianRepos(const QString &url);
-    void replaceRepos(const QString &url);
+    bool replaceDebianRepos(const QString &url);
+    bool replaceRepos(const QString &url);
     void setConnections();
+    void setMatchingEnabled(bool enable);
     void setProgressBar();
-    void setSelected();
+    bool setSelected();
 
 private slots:
     void cancelOperation();
     void closeEvent(QCloseEvent *);
+    void filterSources(const QString &pattern);
     void procDone();
     void procTime();
     void procStart();
@@ -82,10 +105,15 @@ private slots:
     void lineSearch_textChanged(const QString &arg1);
     void pb_restoreSources_clicked();
     void pushAbout_clicked();
+    void pushDuplicates_clicked();
+    void pushEstimate_clicked();
     void pushFastestDebian_clicked();
+    void pushFailover_clicked();
     void pushFastestMX_clicked();
     void pushHelp_clicked();
     void pushOk_clicked();
+    void pushPrune_clicked();
+    void pushUpdate_clicked();
     void tabWidget_currentChanged();
     void treeWidgetDeb_itemChanged(QTreeWidgetItem *item, int column);
     void treeWidget_itemChanged(QTreeWidgetItem *item, int column);
@@ -93,18 +121,29 @@ private slots:
 private:
     Ui::MainWindow *ui;
     Cmd *shell;
+    QHash<QString, MirrorResult> probe_results;
     QHash<QString, QIcon> flags;
+    struct UpdateEntry {
+        UpdateLine line;
+        qint64 start;   // ms from the start of the update until apt printed the line
+        qint64 done;    // ms until the file was done
+    };
+    QList<UpdateEntry> update_log; // last "apt-get update"
+    MirrorProbe *running_probe = nullptr;
+    ProbeSession *session;
+    bool probe_canceled = false;
     QProgressBar *bar;
     QProgressDialog *progress;
     QPushButton *progCancel;
     QSettings settings;
     QString current_repo;
+    QStringList host_archs;
     QStringList repos;
     QTimer timer;
 
     QNetworkAccessManager manager;
     QNetworkReply* reply;
-    bool checkRepo(const QString &repo);
+    bool checkRepo(const QString &repo, const QString &proxy);
     bool downloadFile(const QString &url, QFile &file);
 
 };
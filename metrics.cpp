@@ -0,0 +1,119 @@
+#include "metrics.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QTextStream>
+
+#include "aptsource.h"
+#include "repoconfig.h"
+
+static QString label(const QString &value)
+{
+    return QString(value).replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+}
+
+static bool writeMetricsFile(const QString &dir, const QString &name, const QString &text)
+{
+    if (dir.isEmpty())
+        return true;
+    QSaveFile file(dir + '/' + name);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qDebug() << "Could not write file:" << file.fileName();
+        return false;
+    }
+    file.write(text.toUtf8());
+    return file.commit();
+}
+
+// duration and result of changing the sources, with the number of sources and backups left afterwards;
+// "mode" ("gui" or "cli") is in the labels and the file name, so the GUI and the timer don't replace each other's file
+bool writeApplyMetrics(const QString &dir, const QString &mode, const QList<ApplyMetrics> &applied)
+{
+    QString text;
+    QTextStream out(&text);
+    const QString mode_label = "mode=\"" + label(mode) + "\",";
+    out << "# HELP mx_repo_manager_apply_duration_seconds Time taken to change the APT sources.\n"
+        << "# TYPE mx_repo_manager_apply_duration_seconds gauge\n";
+    for (const ApplyMetrics &apply : applied)
+        out << "mx_repo_manager_apply_duration_seconds{" << mode_label << "root=\"" << label(rootPath(apply.root, "/")) << "\"} " << apply.seconds << '\n';
+    out << "# HELP mx_repo_manager_apply_success Whether the last change of the APT sources succeeded.\n"
+        << "# TYPE mx_repo_manager_apply_success gauge\n";
+    for (const ApplyMetrics &apply : applied)
+        out << "mx_repo_manager_apply_success{" << mode_label << "root=\"" << label(rootPath(apply.root, "/")) << "\"} " << (apply.ok ? 1 : 0) << '\n';
+
+    out << "# HELP mx_repo_manager_sources Number of APT source lines.\n"
+        << "# TYPE mx_repo_manager_sources gauge\n";
+    for (const ApplyMetrics &apply : applied) {
+        int enabled = 0;
+        int disabled = 0;
+        for (const QString &file_name : aptFiles(apply.root)) {
+            QFile file(file_name);
+            if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+                continue;
+            for (const QString &line : QString::fromUtf8(file.readAll()).split('\n')) {
+                const AptSource source = AptSource::parse(line);
+                if (source.isValid())
+                    source.enabled ? ++enabled : ++disabled;
+            }
+        }
+        const QString root = label(rootPath(apply.root, "/"));
+        out << "mx_repo_manager_sources{" << mode_label << "root=\"" << root << "\",state=\"enabled\"} " << enabled << '\n'
+            << "mx_repo_manager_sources{" << mode_label << "root=\"" << root << "\",state=\"disabled\"} " << disabled << '\n';
+    }
+
+    out << "# HELP mx_repo_manager_backups Number of source list backups kept.\n"
+        << "# TYPE mx_repo_manager_backups gauge\n";
+    for (const ApplyMetrics &apply : applied)
+        out << "mx_repo_manager_backups{" << mode_label << "root=\"" << label(rootPath(apply.root, "/")) << "\"} "
+            << QDir(rootPath(apply.root, "/etc/apt/sources.list.d/backups")).entryList(QDir::Files).size() << '\n';
+
+    out << "# HELP mx_repo_manager_apply_timestamp_seconds Time of the last change of the APT sources.\n"
+        << "# TYPE mx_repo_manager_apply_timestamp_seconds gauge\n"
+        << "mx_repo_manager_apply_timestamp_seconds{mode=\"" << label(mode) << "\"} " << QDateTime::currentSecsSinceEpoch() << '\n';
+    out.flush();
+    return writeMetricsFile(dir, "mx_repo_manager_apply_" + mode + ".prom", text);
+}
+
+// per-mirror results of the last probe of this kind ("mx" or "debian") and the mirror chosen, per mode as above
+bool writeProbeMetrics(const QString &dir, const QString &mode, const QString &kind, const QList<MirrorResult> &results, const QString &chosen)
+{
+    QString text;
+    QTextStream out(&text);
+    const QString kind_label = "mode=\"" + label(mode) + "\",kind=\"" + label(kind) + "\",mirror=\"";
+    out << "# HELP mx_repo_manager_probe_success Whether the mirror answered the probe.\n"
+        << "# TYPE mx_repo_manager_probe_success gauge\n";
+    for (const MirrorResult &result : results)
+        out << "mx_repo_manager_probe_success{" << kind_label << label(result.url) << "\"} " << (result.ok() ? 1 : 0) << '\n';
+    out << "# HELP mx_repo_manager_probe_latency_seconds Time to the first byte of the probe file.\n"
+        << "# TYPE mx_repo_manager_probe_latency_seconds gauge\n";
+    for (const MirrorResult &result : results)
+        if (result.ok())
+            out << "mx_repo_manager_probe_latency_seconds{" << kind_label << label(result.url) << "\"} " << result.latency / 1000.0 << '\n';
+    out << "# HELP mx_repo_manager_probe_setup_seconds DNS lookup and connection setup before the probe, not part of the latency.\n"
+        << "# TYPE mx_repo_manager_probe_setup_seconds gauge\n";
+    for (const MirrorResult &result : results)
+        if (result.ok() && result.setup >= 0)
+            out << "mx_repo_manager_probe_setup_seconds{" << kind_label << label(result.url) << "\"} " << result.setup / 1000.0 << '\n';
+    out << "# HELP mx_repo_manager_probe_throughput_bytes_per_second Transfer rate of the probe file.\n"
+        << "# TYPE mx_repo_manager_probe_throughput_bytes_per_second gauge\n";
+    for (const MirrorResult &result : results)
+        if (result.ok())
+            out << "mx_repo_manager_probe_throughput_bytes_per_second{" << kind_label << label(result.url) << "\"} " << qRound64(result.throughput) << '\n';
+    out << "# HELP mx_repo_manager_probe_stale Whether the mirror is behind the newest copy of the repo.\n"
+        << "# TYPE mx_repo_manager_probe_stale gauge\n";
+    for (const MirrorResult &result : results)
+        if (result.ok())
+            out << "mx_repo_manager_probe_stale{" << kind_label << label(result.url) << "\"} " << (result.stale ? 1 : 0) << '\n';
+    out << "# HELP mx_repo_manager_mirror_chosen Mirror selected after the probe.\n"
+        << "# TYPE mx_repo_manager_mirror_chosen gauge\n";
+    if (!chosen.isEmpty())
+        out << "mx_repo_manager_mirror_chosen{" << kind_label << label(chosen) << "\"} 1\n";
+    out << "# HELP mx_repo_manager_probe_timestamp_seconds Time of the last probe.\n"
+        << "# TYPE mx_repo_manager_probe_timestamp_seconds gauge\n"
+        << "mx_repo_manager_probe_timestamp_seconds{mode=\"" << label(mode) << "\",kind=\"" << label(kind) << "\"} " << QDateTime::currentSecsSinceEpoch() << '\n';
+    out.flush();
+    return writeMetricsFile(dir, "mx_repo_manager_probe_" + mode + "_" + kind + ".prom", text);
+}
@@ -0,0 +1,21 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QList>
+#include <QString>
+
+#include "mirrorprobe.h"
+
+// Prometheus text format files for node_exporter's textfile collector, every file is replaced atomically
+
+struct ApplyMetrics
+{
+    QString root;       // empty for the running system
+    double seconds = 0;
+    bool ok = false;
+};
+
+bool writeApplyMetrics(const QString &dir, const QString &mode, const QList<ApplyMetrics> &applied);
+bool writeProbeMetrics(const QString &dir, const QString &mode, const QString &kind, const QList<MirrorResult> &results, const QString &chosen);
+
+#endif // METRICS_H
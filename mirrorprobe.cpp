@@ -0,0 +1,417 @@
+#include "mirrorprobe.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHostInfo>
+#include <QLocale>
+#include <QNetworkProxyFactory>
+#include <QNetworkReply>
+#include <QRegularExpression>
+#include <QSharedPointer>
+#include <QSslSocket>
+#include <QTimer>
+
+#include <algorithm>
+#include <limits>
+
+// estimated ms to fetch 1 MB, lower is better
+double MirrorResult::score() const
+{
+    if (!ok())
+        return std::numeric_limits<double>::max();
+    if (throughput <= 0)
+        return latency;
+    return latency + 1000.0 * 1024 * 1024 / throughput;
+}
+
+// APT's proxy for http requests, except for those addressed to the proxy itself
+class AptProxyFactory : public QNetworkProxyFactory
+{
+public:
+    explicit AptProxyFactory(const QUrl &proxy) : proxy(proxy) {}
+    QList<QNetworkProxy> queryProxy(const QNetworkProxyQuery &query) override
+    {
+        const QUrl url = query.url();
+        if (url.scheme() != "http" || (url.host() == proxy.host() && url.port(80) == proxy.port(80)))
+            return {QNetworkProxy(QNetworkProxy::NoProxy)};
+        return {QNetworkProxy(QNetworkProxy::HttpProxy, proxy.host(), static_cast<quint16>(proxy.port(80)), proxy.userName(), proxy.password())};
+    }
+
+private:
+    QUrl proxy;
+};
+
+// the lookup is left out: it is the same for both schemes, and the second one is answered from Qt's cache
+qint64 ConnectionTiming::total() const
+{
+    if (!ok())
+        return std::numeric_limits<qint64>::max();
+    return connect + qMax<qint64>(tls, 0) + first_byte + transfer;
+}
+
+QString ConnectionTiming::toString() const
+{
+    return QString("%1 dns=%2ms connect=%3ms tls=%4ms first_byte=%5ms transfer=%6ms")
+            .arg(url).arg(dns).arg(connect).arg(tls).arg(first_byte).arg(transfer);
+}
+
+MirrorProbe::MirrorProbe(QNetworkAccessManager *manager, QObject *parent)
+    : QObject(parent),
+      manager(manager)
+{
+}
+
+// probe all mirrors and return them ranked, best first; after cancel() only the mirrors probed so far
+QList<MirrorResult> MirrorProbe::run(const QStringList &mirrors, const QString &path)
+{
+    results.clear();
+    stopping = false;
+    queue = mirrors;
+    queue.removeDuplicates();
+    this->path = path;
+    if (queue.isEmpty())
+        return results;
+
+    // a manager of its own for the proxy, other requests on the shared one must not go through it
+    QNetworkAccessManager proxied;
+    useAptProxy(&proxied, proxy);
+    active_manager = proxy.isEmpty() ? manager : &proxied;
+    ProbeSession own_session(manager);
+    active_session = session ? session : &own_session;
+    if (proxy.isEmpty()) { // the proxy resolves and connects for us otherwise
+        QStringList urls;
+        for (const QString &mirror : qAsConst(queue))
+            urls << join(mirror, path);
+        active_session->prepare(urls, timeout, true);
+    }
+    if (stopping) { // canceled while preparing, with no loop to quit yet
+        active_session = nullptr;
+        active_manager = nullptr;
+        return results;
+    }
+
+    QEventLoop loop;
+    this->loop = &loop;
+    for (int i = 0; i < parallel; ++i)
+        probeNext();
+    loop.exec();
+    this->loop = nullptr;
+    active_session = nullptr;
+    active_manager = nullptr;
+
+    rank(results, stale_after);
+    return results;
+}
+
+void MirrorProbe::cancel()
+{
+    stopping = true;
+    queue.clear();
+    const QList<QNetworkReply *> active = replies;
+    for (QNetworkReply *reply : active)
+        reply->abort();
+    if (loop)
+        loop->quit();
+}
+
+// GET url over a direct connection of its own so that every step can be timed, QNetworkAccessManager hides them
+ConnectionTiming MirrorProbe::timeConnection(const QString &url)
+{
+    ConnectionTiming timing;
+    timing.url = url;
+    const QUrl target(url);
+    const bool https = target.scheme() == "https";
+
+    QEventLoop loop;
+    QTimer deadline;
+    deadline.setSingleShot(true);
+    connect(&deadline, &QTimer::timeout, &loop, &QEventLoop::quit);
+    deadline.start(timeout);
+    QElapsedTimer timer;
+    timer.start();
+
+    QHostInfo host;
+    QHostInfo::lookupHost(target.host(), &loop, [&host, &loop](const QHostInfo &info) {
+        host = info;
+        loop.quit();
+    });
+    loop.exec();
+    if (host.error() != QHostInfo::NoError || host.addresses().isEmpty()) {
+        qDebug() << "Could not resolve" << target.host();
+        return timing;
+    }
+    timing.dns = timer.restart();
+
+    QSslSocket socket;
+    connect(&socket, &QAbstractSocket::connected, &loop, &QEventLoop::quit);
+    connect(&socket, &QSslSocket::encrypted, &loop, &QEventLoop::quit);
+    connect(&socket, &QIODevice::readyRead, &loop, &QEventLoop::quit);
+    connect(&socket, &QAbstractSocket::disconnected, &loop, &QEventLoop::quit);
+    connect(&socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error), &loop, &QEventLoop::quit);
+    socket.connectToHost(host.addresses().first(), static_cast<quint16>(target.port(https ? 443 : 80)));
+    while (deadline.isActive() && socket.state() == QAbstractSocket::ConnectingState)
+        loop.exec();
+    if (socket.state() != QAbstractSocket::ConnectedState)
+        return timing;
+    timing.connect = timer.restart();
+
+    if (https) {
+        socket.setPeerVerifyName(target.host()); // also sent as SNI
+        socket.startClientEncryption();
+        while (deadline.isActive() && socket.state() == QAbstractSocket::ConnectedState && !socket.isEncrypted())
+            loop.exec();
+        if (!socket.isEncrypted())
+            return timing;
+        timing.tls = timer.restart();
+    }
+
+    socket.write("GET " + target.path(QUrl::FullyEncoded).toUtf8() + " HTTP/1.1\r\nHost: " + target.host().toUtf8()
+                 + "\r\nUser-Agent: " + userAgent() + "\r\nConnection: close\r\n\r\n");
+    QByteArray response;
+    while (deadline.isActive() && socket.state() == QAbstractSocket::ConnectedState) {
+        loop.exec();
+        if (socket.bytesAvailable() > 0 && timing.first_byte < 0)
+            timing.first_byte = timer.restart();
+        response += socket.readAll();
+        const int body = response.indexOf("\r\n\r\n");
+        static const QRegularExpression length_re("\r\nContent-Length:\\s*(\\d+)", QRegularExpression::CaseInsensitiveOption);
+        const QRegularExpressionMatch length = length_re.match(QString::fromLatin1(response.left(body)));
+        if (body >= 0 && length.hasMatch() && response.size() - body - 4 >= length.captured(1).toLongLong())
+            break; // the server may keep the connection open despite "Connection: close"
+    }
+    response += socket.readAll();
+    if (timing.first_byte < 0 || !deadline.isActive())
+        return timing;
+    if (!response.startsWith("HTTP/1.1 200") && !response.startsWith("HTTP/1.0 200")) { // e.g. a redirect to the other scheme
+        qDebug() << "No file from" << url << response.left(response.indexOf('\r'));
+        return timing;
+    }
+    timing.transfer = timer.elapsed();
+    return timing;
+}
+
+// the mirror with http or https, whichever costs less to fetch path over a new connection;
+// apt checks the signatures either way, so the scheme only changes the cost. With APT's proxy the direct
+// connections timeConnection() makes are not what APT uses, the mirror is kept as it is then.
+QString MirrorProbe::cheaperScheme(const QString &mirror, const QString &path)
+{
+    const QUrl url(mirror);
+    if (url.scheme() != "http" && url.scheme() != "https")
+        return mirror;
+    if (!proxy.isEmpty()) {
+        qDebug() << "Not comparing http and https through the proxy" << proxy;
+        return mirror;
+    }
+    QUrl http = url;
+    http.setScheme("http");
+    QUrl https = url;
+    https.setScheme("https");
+    const ConnectionTiming plain = timeConnection(join(http.toString(), path));
+    const ConnectionTiming secure = timeConnection(join(https.toString(), path));
+    qDebug().noquote() << plain.toString();
+    qDebug().noquote() << secure.toString();
+
+    const ConnectionTiming &current = (url.scheme() == "https") ? secure : plain;
+    const ConnectionTiming &other = (url.scheme() == "https") ? plain : secure;
+    if (!other.ok() || (current.ok() && other.total() * 1.1 >= current.total())) // keep the scheme unless the other is clearly cheaper
+        return mirror;
+    return (url.scheme() == "https" ? http : https).toString();
+}
+
+QString MirrorProbe::join(const QString &url, const QString &path)
+{
+    if (url.endsWith('/') && path.startsWith('/'))
+        return url + path.mid(1);
+    if (url.endsWith('/') || path.startsWith('/'))
+        return url + path;
+    return url + '/' + path;
+}
+
+// working mirrors first, outdated ones after the up-to-date ones whatever their speed
+void MirrorProbe::rank(QList<MirrorResult> &results, qint64 stale_after)
+{
+    QDateTime newest;
+    for (const MirrorResult &result : qAsConst(results))
+        if (result.updated.isValid() && (!newest.isValid() || result.updated > newest))
+            newest = result.updated;
+    for (MirrorResult &result : results)
+        result.stale = newest.isValid() && result.updated.isValid() && result.updated.secsTo(newest) > stale_after;
+
+    std::stable_sort(results.begin(), results.end(), [](const MirrorResult &a, const MirrorResult &b) {
+        if (a.ok() && b.ok() && a.stale != b.stale)
+            return b.stale;
+        return a.score() < b.score();
+    });
+}
+
+// "Date: Sat, 14 Aug 2021 07:35:38 UTC" from the start of an InRelease file
+static QDateTime releaseDate(const QByteArray &head)
+{
+    for (const QByteArray &line : head.split('\n')) {
+        if (!line.startsWith("Date:"))
+            continue;
+        const QString value = QString::fromLatin1(line.mid(5)).trimmed();
+        QDateTime date = QLocale::c().toDateTime(value, "ddd, dd MMM yyyy HH:mm:ss 'UTC'");
+        if (!date.isValid())
+            date = QDateTime::fromString(value, Qt::RFC2822Date);
+        date.setTimeSpec(Qt::UTC);
+        return date;
+    }
+    return QDateTime();
+}
+
+void MirrorProbe::probeNext()
+{
+    if (queue.isEmpty()) {
+        if (running == 0 && loop)
+            loop->quit();
+        return;
+    }
+    const QString mirror = queue.takeFirst();
+    ++running;
+
+    // without a proxy a host the resolver knows nothing about fails right away instead of after the timeout,
+    // one it didn't answer for in time gets another chance with the request
+    const QString host = QUrl(join(mirror, path)).host();
+    if (proxy.isEmpty() && active_session->isUnresolvable(host)) {
+        QTimer::singleShot(0, this, [this, mirror]() { // the loop may not be running yet
+            --running;
+            MirrorResult result;
+            result.url = mirror;
+            qDebug() << "Probe failed:" << mirror << "host not found";
+            results << result;
+            emit resultReady(result);
+            probeNext();
+        });
+        return;
+    }
+    probeGet(mirror, proxy.isEmpty() ? active_session->setupTime(QUrl(join(mirror, path))) : -1);
+}
+
+void MirrorProbe::probeGet(const QString &mirror, qint64 setup)
+{
+    QNetworkRequest request = appRequest(join(mirror, path));
+    request.setAttribute(QNetworkRequest::RedirectPolicyAttribute, QNetworkRequest::UserVerifiedRedirectPolicy);
+
+    struct Timing {
+        QElapsedTimer timer;    // restarted when following a redirect
+        qint64 redirects = 0;   // ms for redirects and for setting up the connections they lead to
+        qint64 first_byte = -1;
+        qint64 bytes = 0;
+        QByteArray head;
+    };
+    auto timing = QSharedPointer<Timing>::create();
+    timing->timer.start();
+    QNetworkReply *reply = active_manager->get(request);
+    replies << reply;
+
+    // a redirect (e.g. from http to https or to another host) is setup as well: the file is timed from the request
+    // that gets it, after a connection to where it leads is ready (through a proxy the proxy connects for us)
+    connect(reply, &QNetworkReply::redirected, this, [this, reply, timing](const QUrl &target) {
+        timing->redirects += timing->timer.restart();
+        timing->first_byte = -1;
+        timing->bytes = 0;
+        timing->head.clear();
+        const auto follow = [reply, timing]() {
+            if (reply->isFinished())
+                return;
+            timing->redirects += timing->timer.restart();
+            emit reply->redirectAllowed();
+        };
+        if (!proxy.isEmpty() || !active_session)
+            follow();
+        else
+            active_session->prepareRedirect(target, timeout, reply, follow);
+    });
+
+    connect(reply, &QNetworkReply::readyRead, this, [reply, timing]() {
+        if (timing->first_byte < 0)
+            timing->first_byte = timing->timer.elapsed();
+        const QByteArray data = reply->readAll();
+        timing->bytes += data.size();
+        if (timing->head.size() < 4096)
+            timing->head += data.left(4096 - timing->head.size());
+    });
+    QTimer::singleShot(timeout, reply, &QNetworkReply::abort);
+    connect(reply, &QNetworkReply::finished, this, [this, mirror, setup, reply, timing]() {
+        replies.removeOne(reply);
+        reply->deleteLater();
+        --running;
+        if (stopping && reply->error() == QNetworkReply::OperationCanceledError) { // cut short, not the mirror's fault
+            probeNext();
+            return;
+        }
+        MirrorResult result;
+        result.url = mirror;
+        result.bytes = timing->bytes;
+        result.setup = (timing->redirects > 0) ? qMax<qint64>(0, setup) + timing->redirects : setup;
+        if (reply->error() == QNetworkReply::NoError) {
+            const qint64 total = timing->timer.elapsed();
+            result.latency = (timing->first_byte < 0) ? total : timing->first_byte;
+            if (total > result.latency && result.bytes > 0)
+                result.throughput = 1000.0 * result.bytes / (total - result.latency);
+            result.updated = releaseDate(timing->head);
+        } else {
+            qDebug() << "Probe failed:" << reply->url() << reply->error();
+        }
+        results << result;
+        emit resultReady(result);
+        probeNext();
+    });
+}
+
+// "mx-repo-manager/<version> (linux-gnu)", sent with every request the app makes
+QByteArray userAgent()
+{
+    return qApp->applicationName().toUtf8() + "/" + qApp->applicationVersion().toUtf8() + " (linux-gnu)";
+}
+
+// request for url with the app's User-Agent, callers add what else they need
+QNetworkRequest appRequest(const QString &url)
+{
+    QNetworkRequest request;
+    request.setRawHeader("User-Agent", userAgent());
+    request.setUrl(QUrl(url));
+    return request;
+}
+
+// send the http requests of "manager" through APT's proxy like APT's downloads, if it uses one
+void useAptProxy(QNetworkAccessManager *manager, const QString &proxy)
+{
+    if (!proxy.isEmpty())
+        manager->setProxyFactory(new AptProxyFactory(QUrl(proxy))); // the manager takes ownership
+}
+
+// GET url into file, aborted when nothing arrives for stall_timeout ms, a mirror that stops sending would otherwise
+// block forever; "write_error" tells a file that could not be written from a failed download
+bool fetchFile(QNetworkAccessManager *manager, const QString &url, QIODevice *file, int stall_timeout, bool *write_error)
+{
+    QNetworkReply *reply = manager->get(appRequest(url));
+    QEventLoop loop;
+
+    QTimer stall;
+    stall.setSingleShot(true);
+    QObject::connect(&stall, &QTimer::timeout, reply, &QNetworkReply::abort);
+    stall.start(stall_timeout);
+
+    bool written = true;
+    QObject::connect(reply, &QNetworkReply::readyRead, &loop, [reply, file, &written, &stall]() {
+        const QByteArray data = reply->readAll();
+        written = file->write(data) == data.size();
+        if (written)
+            stall.start();
+        else
+            reply->abort();
+    });
+    QObject::connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+    loop.exec();
+    stall.stop();
+    reply->deleteLater();
+
+    if (write_error)
+        *write_error = !written;
+    if (reply->error() != QNetworkReply::NoError)
+        qDebug() << "Download failed:" << url << reply->error();
+    return written && reply->error() == QNetworkReply::NoError;
+}
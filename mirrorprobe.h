@@ -0,0 +1,87 @@
+#ifndef MIRRORPROBE_H
+#define MIRRORPROBE_H
+
+#include <QDateTime>
+#include <QEventLoop>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QStringList>
+
+#include "probesession.h"
+
+struct MirrorResult
+{
+    QString url;            // mirror as listed, e.g. "http://mxrepo.com"
+    qint64 latency = -1;    // ms until the first byte of the test file, -1 if the probe failed
+    qint64 setup = -1;      // ms for the DNS lookup (if not answered earlier), connect and redirects before it, not part of latency;
+                            // -1 if unknown
+    qint64 bytes = 0;       // size of the test file
+    double throughput = 0;  // bytes/s after the first byte
+    QDateTime updated;      // "Date:" of the InRelease file
+    bool stale = false;     // much older than the newest copy found, the mirror doesn't sync
+
+    bool ok() const { return latency >= 0; }
+    double score() const;
+};
+
+// where the time of one request over a new connection goes, ms, -1 for steps not reached
+struct ConnectionTiming
+{
+    QString url;
+    qint64 dns = -1;
+    qint64 connect = -1;
+    qint64 tls = -1;            // stays -1 for http
+    qint64 first_byte = -1;     // from sending the request
+    qint64 transfer = -1;       // from the first to the last byte, set once the whole file arrived
+
+    bool ok() const { return transfer >= 0; }
+    qint64 total() const;
+    QString toString() const;
+};
+
+// download a small file from every mirror (a few at a time) and rank mirrors by how fast they serve it
+class MirrorProbe : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MirrorProbe(QNetworkAccessManager *manager, QObject *parent = nullptr);
+
+    QList<MirrorResult> run(const QStringList &mirrors, const QString &path);
+    void cancel();
+    bool isCanceled() const { return stopping; }
+    ConnectionTiming timeConnection(const QString &url);
+    QString cheaperScheme(const QString &mirror, const QString &path);
+    static QString join(const QString &url, const QString &path);
+    static void rank(QList<MirrorResult> &results, qint64 stale_after = 86400);
+
+    int parallel = 4;
+    int timeout = 5000;         // ms for a probe from start to the last byte, the lookups and the connects before have as long
+    qint64 stale_after = 86400; // s a mirror may lag behind the newest one
+    QString proxy;              // APT's http proxy, http probes go through it like APT's downloads do
+    ProbeSession *session = nullptr; // resolved hosts and open connections shared across runs, a new one for each run if not set
+
+signals:
+    void resultReady(const MirrorResult &result);
+
+private:
+    void probeNext();
+    void probeGet(const QString &mirror, qint64 setup);
+
+    ProbeSession *active_session = nullptr;
+    QNetworkAccessManager *active_manager = nullptr; // "manager", or one of its own that uses the proxy
+    QEventLoop *loop = nullptr;
+    QList<MirrorResult> results;
+    QList<QNetworkReply *> replies;
+    QNetworkAccessManager *manager;
+    QString path;
+    QStringList queue;
+    bool stopping = false;
+    int running = 0;
+};
+
+QByteArray userAgent();
+QNetworkRequest appRequest(const QString &url);
+void useAptProxy(QNetworkAccessManager *manager, const QString &proxy);
+bool fetchFile(QNetworkAccessManager *manager, const QString &url, QIODevice *file, int stall_timeout, bool *write_error = nullptr);
+
+#endif // MIRRORPROBE_H
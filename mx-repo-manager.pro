@@ -20,7 +20,7 @@
 # * along with mx-repo-manager.  If not, see <http://www.gnu.org/licenses/>.
 # **********************************************************************/
 
-QT       += core gui network widgets
+QT       += core gui network widgets concurrent
 CONFIG   += c++17
 
 TARGET = mx-repo-manager
@@ -35,12 +35,26 @@ DEFINES += QT_DEPRECATED_WARNINGS
 SOURCES += main.cpp\
     mainwindow.cpp \
     cmd.cpp \
-    about.cpp
+    about.cpp \
+    aptsource.cpp \
+    cli.cpp \
+    metrics.cpp \
+    mirrorprobe.cpp \
+    probesession.cpp \
+    ranking.cpp \
+    repoconfig.cpp
 
 HEADERS  += mainwindow.h \
     version.h \
     cmd.h \
-    about.h
+    about.h \
+    aptsource.h \
+    cli.h \
+    metrics.h \
+    mirrorprobe.h \
+    probesession.h \
+    ranking.h \
+    repoconfig.h
 
 FORMS    += mainwindow.ui
 
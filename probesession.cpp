@@ -0,0 +1,183 @@
+#include "probesession.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHostInfo>
+#include <QSet>
+#include <QSharedPointer>
+#include <QSslSocket>
+#include <QTimer>
+
+ProbeSession::ProbeSession(QNetworkAccessManager *manager, QObject *parent)
+    : QObject(parent),
+      manager(manager)
+{
+}
+
+// Resolve the hosts of all URLs at once, except those the resolver answered for within the last minute (Qt caches
+// addresses that long), and open a connection to each origin whose host has an address. Hosts without an answer
+// within "timeout" ms are left to the requests, a slow resolver is no reason to give up on a mirror. With
+// "time_setup" a connection of its own to each origin times the connect (and TLS handshake) for setupTime(), for up
+// to "timeout" ms more. Returns the ms it took.
+qint64 ProbeSession::prepare(const QStringList &urls, int timeout, bool time_setup)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QHash<QString, QUrl> targets; // origin -> first URL
+    QSet<QString> names;
+    for (const QString &url : urls) {
+        const QUrl parsed(url);
+        if (parsed.host().isEmpty() || targets.contains(origin(parsed)))
+            continue;
+        targets.insert(origin(parsed), parsed);
+        names.insert(parsed.host());
+    }
+
+    // an answer after the timeout is dropped with the loop
+    QEventLoop lookup_loop;
+    int pending = names.size();
+    for (const QString &host : qAsConst(names))
+        resolve(host, &lookup_loop, [&pending, &lookup_loop]() {
+            if (--pending == 0)
+                lookup_loop.quit();
+        });
+    if (pending > 0) {
+        QTimer::singleShot(timeout, &lookup_loop, &QEventLoop::quit);
+        lookup_loop.exec();
+    }
+
+    QEventLoop connect_loop;
+    {
+        QObject sockets; // timing connections still open at the timeout are closed with it
+        pending = targets.size();
+        for (const QUrl &url : qAsConst(targets))
+            connectTo(url, time_setup, timeout, &sockets, [&pending, &connect_loop]() {
+                if (--pending == 0)
+                    connect_loop.quit();
+            });
+        if (pending > 0) {
+            QTimer::singleShot(timeout, &connect_loop, &QEventLoop::quit);
+            connect_loop.exec();
+        }
+    }
+
+    qint64 slowest = 0;
+    int resolved = 0;
+    for (const QString &host : qAsConst(names)) {
+        const Host &info = hosts.value(host);
+        if (info.lookup >= 0)
+            ++resolved;
+        slowest = qMax(slowest, info.lookup);
+    }
+    qDebug() << "Prepared" << targets.size() << "origins in" << elapsed.elapsed() << "ms," << resolved << "of" << names.size()
+             << "hosts resolved, slowest lookup" << slowest << "ms";
+    return elapsed.elapsed();
+}
+
+// the same for a URL a request was redirected to, without blocking: "done" is called once the connection is timed
+// or after "timeout" ms, not at all if "context" is gone first
+void ProbeSession::prepareRedirect(const QUrl &url, int timeout, QObject *context, const std::function<void()> &done)
+{
+    connects.remove(origin(url));
+    auto finished = QSharedPointer<bool>::create(false);
+    const auto finish = [finished, done]() {
+        if (*finished)
+            return;
+        *finished = true;
+        done();
+    };
+    QTimer::singleShot(timeout, context, finish);
+    resolve(url.host(), context, [this, url, timeout, context, finish]() {
+        connectTo(url, true, timeout, context, finish);
+    });
+}
+
+// ms spent on the origin of url before its first request: the lookup of its host unless an earlier answer was used,
+// and the connect; -1 if the connect was not timed
+qint64 ProbeSession::setupTime(const QUrl &url) const
+{
+    const qint64 connect = connects.value(origin(url), -1);
+    if (connect < 0)
+        return -1;
+    return qMax<qint64>(0, hosts.value(url.host()).lookup) + connect;
+}
+
+// the resolver answered within the last minute that the host has no address
+bool ProbeSession::isUnresolvable(const QString &host) const
+{
+    const Host info = hosts.value(host);
+    return info.answered.isValid() && !info.found && info.answered.secsTo(QDateTime::currentDateTimeUtc()) < 60;
+}
+
+// "https://mirror:443", connections are kept and reused per origin
+QString ProbeSession::origin(const QUrl &url)
+{
+    const int port = url.port(url.scheme() == "https" ? 443 : 80);
+    return url.scheme() + "://" + url.host() + ':' + QString::number(port);
+}
+
+// look the host up unless the resolver answered within the last minute; a timed out lookup is not remembered
+void ProbeSession::resolve(const QString &host, QObject *context, const std::function<void()> &done)
+{
+    Host &info = hosts[host];
+    info.lookup = -1;
+    if (info.answered.isValid() && info.answered.secsTo(QDateTime::currentDateTimeUtc()) < 60) {
+        done();
+        return;
+    }
+    auto timer = QSharedPointer<QElapsedTimer>::create();
+    timer->start();
+    QHostInfo::lookupHost(host, context, [this, host, timer, done](const QHostInfo &result) {
+        Host &info = hosts[host];
+        info.answered = QDateTime::currentDateTimeUtc();
+        info.found = result.error() == QHostInfo::NoError && !result.addresses().isEmpty();
+        info.lookup = timer->elapsed();
+        done();
+    });
+}
+
+// open a connection to the origin of url on the manager, which uses it for the first request to it; with
+// "time_setup" also one on a socket of its own that times the connect, given up after "timeout" ms
+void ProbeSession::connectTo(const QUrl &url, bool time_setup, int timeout, QObject *context, const std::function<void()> &done)
+{
+    const QString key = origin(url);
+    const bool https = url.scheme() == "https";
+    connects.remove(key);
+    if (!hosts.value(url.host()).found || (!https && url.scheme() != "http")) {
+        done();
+        return;
+    }
+    const quint16 port = static_cast<quint16>(url.port(https ? 443 : 80));
+    if (https)
+        manager->connectToHostEncrypted(url.host(), port);
+    else
+        manager->connectToHost(url.host(), port);
+    if (!time_setup) {
+        done();
+        return;
+    }
+
+    auto *socket = new QSslSocket(context);
+    auto timer = QSharedPointer<QElapsedTimer>::create();
+    timer->start();
+    const auto finish = [this, key, socket, timer, done](bool ok) {
+        if (!timer->isValid()) // error after success, or the other way round
+            return;
+        if (ok)
+            connects.insert(key, timer->elapsed());
+        timer->invalidate();
+        socket->deleteLater();
+        done();
+    };
+    QTimer::singleShot(timeout, socket, [finish]() { finish(false); });
+    if (https)
+        connect(socket, &QSslSocket::encrypted, socket, [finish]() { finish(true); });
+    else
+        connect(socket, &QAbstractSocket::connected, socket, [finish]() { finish(true); });
+    connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::error), socket, [finish]() { finish(false); });
+    if (https)
+        socket->connectToHostEncrypted(url.host(), port);
+    else
+        socket->connectToHost(url.host(), port);
+}
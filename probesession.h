@@ -0,0 +1,41 @@
+#ifndef PROBESESSION_H
+#define PROBESESSION_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QNetworkAccessManager>
+#include <QStringList>
+#include <QUrl>
+
+#include <functional>
+
+// Network state shared by all requests to the mirrors: the hosts are resolved in parallel before probing and a
+// connection to each origin (scheme://host:port) is opened ahead, so that probes time the mirrors and not the local
+// resolver or the handshakes. The manager keeps the connections alive for the requests that follow.
+class ProbeSession : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ProbeSession(QNetworkAccessManager *manager, QObject *parent = nullptr);
+
+    qint64 prepare(const QStringList &urls, int timeout, bool time_setup = false);
+    void prepareRedirect(const QUrl &url, int timeout, QObject *context, const std::function<void()> &done);
+    qint64 setupTime(const QUrl &url) const;
+    bool isUnresolvable(const QString &host) const;
+    static QString origin(const QUrl &url);
+
+private:
+    struct Host {
+        QDateTime answered;     // when the resolver last answered for the host
+        bool found = false;     // the answer had an address
+        qint64 lookup = -1;     // ms of the last lookup, -1 if an earlier answer was used
+    };
+    void resolve(const QString &host, QObject *context, const std::function<void()> &done);
+    void connectTo(const QUrl &url, bool time_setup, int timeout, QObject *context, const std::function<void()> &done);
+
+    QHash<QString, Host> hosts;
+    QHash<QString, qint64> connects;    // origin -> ms to connect (https: and for the handshake) the last time it was timed
+    QNetworkAccessManager *manager;
+};
+
+#endif // PROBESESSION_H
@@ -0,0 +1,212 @@
+#include "ranking.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QMessageAuthenticationCode>
+#include <QSaveFile>
+#include <QTimer>
+
+#include "repoconfig.h"
+
+static QByteArray checksum(const QByteArray &data, const QByteArray &key)
+{
+    if (key.isEmpty())
+        return QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+    return QMessageAuthenticationCode::hash(data, key, QCryptographicHash::Sha256).toHex();
+}
+
+RankingPolicy RankingPolicy::fromSettings(QSettings &settings)
+{
+    RankingPolicy policy;
+    settings.beginGroup("ranking");
+    policy.source = settings.value("source").toString();
+    policy.network = settings.value("network").toString();
+    policy.max_age = settings.value("maxAge", policy.max_age).toInt();
+    policy.target_latency = settings.value("targetLatency", policy.target_latency).toInt();
+    QFile key_file(settings.value("keyFile").toString());
+    if (key_file.open(QIODevice::ReadOnly))
+        policy.key = key_file.readAll().trimmed();
+    settings.endGroup();
+    return policy;
+}
+
+// the checksum covers the compact JSON of everything else, QJsonObject keeps keys sorted so it is reproducible
+QByteArray Ranking::toJson(const QByteArray &key) const
+{
+    QJsonArray array;
+    for (const MirrorResult &result : mirrors)
+        array << QJsonObject {{"url", result.url}, {"latency", result.latency}, {"bytes", result.bytes}, {"throughput", result.throughput}};
+    QJsonObject object {{"version", 1}, {"timestamp", timestamp.toUTC().toString(Qt::ISODate)}, {"network", network}, {"mirrors", array}};
+    object.insert(key.isEmpty() ? "sha256" : "hmac-sha256", QString(checksum(QJsonDocument(object).toJson(QJsonDocument::Compact), key)));
+    return QJsonDocument(object).toJson();
+}
+
+bool Ranking::fromJson(const QByteArray &data, const QByteArray &key, Ranking *ranking, QString *error)
+{
+    QJsonObject object = QJsonDocument::fromJson(data).object();
+    const QString sum_key = key.isEmpty() ? "sha256" : "hmac-sha256";
+    const QByteArray sum = object.take(sum_key).toString().toLatin1();
+    if (object.value("version").toInt() != 1) {
+        *error = "unknown format";
+        return false;
+    }
+    if (sum.isEmpty() || sum != checksum(QJsonDocument(object).toJson(QJsonDocument::Compact), key)) {
+        *error = "missing or wrong " + sum_key;
+        return false;
+    }
+    ranking->timestamp = QDateTime::fromString(object.value("timestamp").toString(), Qt::ISODate);
+    ranking->network = object.value("network").toString();
+    ranking->mirrors.clear();
+    for (const QJsonValue &value : object.value("mirrors").toArray()) {
+        const QJsonObject entry = value.toObject();
+        MirrorResult result;
+        result.url = entry.value("url").toString();
+        result.latency = entry.value("latency").toVariant().toLongLong();
+        result.bytes = entry.value("bytes").toVariant().toLongLong();
+        result.throughput = entry.value("throughput").toDouble();
+        ranking->mirrors << result;
+    }
+    return true;
+}
+
+// the publisher's clock may be a few minutes ahead of ours
+bool Ranking::isFresh(int max_age) const
+{
+    const qint64 age = timestamp.secsTo(QDateTime::currentDateTimeUtc());
+    return timestamp.isValid() && age >= -300 && age <= max_age * 3600LL;
+}
+
+QByteArray fetchRanking(QNetworkAccessManager *manager, const QString &source)
+{
+    if (!source.startsWith("http://") && !source.startsWith("https://")) {
+        QFile file(source);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qDebug() << "Could not open file:" << source;
+            return QByteArray();
+        }
+        return file.readAll();
+    }
+
+    QNetworkRequest request = appRequest(source);
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    QNetworkReply *reply = manager->get(request);
+    QEventLoop loop;
+    QObject::connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+    QTimer::singleShot(5000, reply, &QNetworkReply::abort);
+    loop.exec();
+    reply->deleteLater();
+    if (reply->error() != QNetworkReply::NoError) {
+        qDebug() << "Could not download ranking:" << source << reply->error();
+        return QByteArray();
+    }
+    return reply->readAll();
+}
+
+// write to a local path atomically or PUT to an http(s) URL
+bool publishRanking(QNetworkAccessManager *manager, const QString &target, const QByteArray &data)
+{
+    if (!target.startsWith("http://") && !target.startsWith("https://")) {
+        QSaveFile file(target);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qDebug() << "Could not write file:" << target;
+            return false;
+        }
+        file.write(data);
+        return file.commit();
+    }
+
+    QNetworkRequest request = appRequest(target);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+    QNetworkReply *reply = manager->put(request, data);
+    QEventLoop loop;
+    QObject::connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
+    QTimer::singleShot(10000, reply, &QNetworkReply::abort);
+    loop.exec();
+    reply->deleteLater();
+    if (reply->error() != QNetworkReply::NoError) {
+        qDebug() << "Could not upload ranking:" << target << reply->error();
+        return false;
+    }
+    return true;
+}
+
+// the "count" of "urls" with the best scores in the history of --rerank, best first; mirrors without a score are left out
+QStringList bestFromHistory(QSettings &settings, const QStringList &urls, int count)
+{
+    QMultiMap<double, QString> known;
+    settings.beginGroup("rerank/history");
+    for (const QString &url : urls)
+        if (settings.contains(mirrorHost(url)))
+            known.insert(settings.value(mirrorHost(url)).toDouble(), url);
+    settings.endGroup();
+    return known.values().mid(0, count);
+}
+
+// Use a fresh shared ranking when the policy has one, otherwise probe the mirrors here; best first.
+// Probes start with the nearby mirrors, the others are probed only when none of the nearby ones
+// answers within policy.target_latency; an empty "nearby" probes all mirrors at once.
+QList<MirrorResult> rankMXMirrors(QNetworkAccessManager *manager, MirrorProbe *probe, const QStringList &mirrors,
+                                  const QString &ver_name, const RankingPolicy &policy, const QStringList &nearby)
+{
+    if (!policy.source.isEmpty()) {
+        Ranking ranking;
+        QString error;
+        const QByteArray data = fetchRanking(manager, policy.source);
+        if (data.isEmpty()) {
+            qDebug() << "No shared ranking from" << policy.source;
+        } else if (!Ranking::fromJson(data, policy.key, &ranking, &error)) {
+            qDebug() << "Rejected shared ranking:" << error;
+        } else if (!ranking.isFresh(policy.max_age)) {
+            qDebug() << "Shared ranking is stale:" << ranking.timestamp;
+        } else if (!policy.network.isEmpty() && ranking.network != policy.network) {
+            qDebug() << "Shared ranking is for network" << ranking.network << "not" << policy.network;
+        } else {
+            // only mirrors we know about, a ranking must not be able to add new hosts
+            QList<MirrorResult> known;
+            for (const MirrorResult &result : qAsConst(ranking.mirrors))
+                if (mirrors.contains(result.url))
+                    known << result;
+            MirrorProbe::rank(known);
+            if (!known.isEmpty() && known.first().ok()) {
+                qDebug() << "Using shared ranking from" << ranking.timestamp << "network" << ranking.network;
+                return known;
+            }
+        }
+    }
+    const QString path = "/mx/repo/dists/" + ver_name + "/InRelease";
+    QStringList first;
+    for (const QString &url : nearby)
+        if (mirrors.contains(url))
+            first << url;
+    first.removeDuplicates();
+    if (first.isEmpty() || first.size() == mirrors.size() || policy.target_latency <= 0)
+        return probe->run(mirrors, path);
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QList<MirrorResult> results = probe->run(first, path);
+    if (!results.isEmpty() && results.first().ok() && results.first().latency <= policy.target_latency) {
+        qInfo().noquote() << QString("Decided after %1 of %2 probes in %3 ms, %4 answered in %5 ms")
+                             .arg(results.size()).arg(mirrors.size()).arg(elapsed.elapsed()).arg(results.first().url).arg(results.first().latency);
+        return results;
+    }
+    if (probe->isCanceled())
+        return results;
+    QStringList rest;
+    for (const QString &url : mirrors)
+        if (!first.contains(url))
+            rest << url;
+    qInfo().noquote() << "No nearby mirror answered within" << policy.target_latency << "ms, probing" << rest.size() << "more";
+    results << probe->run(rest, path);
+    MirrorProbe::rank(results, probe->stale_after);
+    qInfo().noquote() << QString("Decided after %1 of %2 probes in %3 ms").arg(results.size()).arg(mirrors.size()).arg(elapsed.elapsed());
+    return results;
+}
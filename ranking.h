@@ -0,0 +1,40 @@
+#ifndef RANKING_H
+#define RANKING_H
+
+#include <QDateTime>
+#include <QSettings>
+
+#include "mirrorprobe.h"
+
+// where to get a ranking made by another host and when to trust it
+struct RankingPolicy
+{
+    QString source;     // file or http(s) URL, empty to always probe locally
+    QString network;    // accept only rankings made for this network tag, empty accepts any
+    QByteArray key;     // shared secret for HMAC-SHA256 signatures, empty for plain SHA-256 checksums
+    int max_age = 24;   // hours
+    int target_latency = 200; // ms a nearby mirror has to answer in to skip probing the others, 0 probes all at once
+
+    static RankingPolicy fromSettings(QSettings &settings);
+};
+
+// mirror ranking shared across hosts so that only one of them has to probe
+class Ranking
+{
+public:
+    static bool fromJson(const QByteArray &data, const QByteArray &key, Ranking *ranking, QString *error);
+    QByteArray toJson(const QByteArray &key) const;
+    bool isFresh(int max_age) const;
+
+    QDateTime timestamp;
+    QString network;
+    QList<MirrorResult> mirrors;
+};
+
+QByteArray fetchRanking(QNetworkAccessManager *manager, const QString &source);
+bool publishRanking(QNetworkAccessManager *manager, const QString &target, const QByteArray &data);
+QList<MirrorResult> rankMXMirrors(QNetworkAccessManager *manager, MirrorProbe *probe, const QStringList &mirrors,
+                                  const QString &ver_name, const RankingPolicy &policy, const QStringList &nearby = QStringList());
+QStringList bestFromHistory(QSettings &settings, const QStringList &urls, int count);
+
+#endif // RANKING_H
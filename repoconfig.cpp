@@ -0,0 +1,380 @@
+#include "repoconfig.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMetaEnum>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QTimeZone>
+#include <QUrl>
+
+#include "aptsource.h"
+
+static QStringList readLines(const QString &file_name)
+{
+    QFile file(file_name);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return QStringList();
+    return QString::fromUtf8(file.readAll()).split('\n');
+}
+
+QString rootPath(const QString &root, const QString &path)
+{
+    if (root.isEmpty() || root == "/")
+        return path;
+    return QDir::cleanPath(root + '/' + path);
+}
+
+// one-line-style source files, sources.list last
+QStringList aptFiles(const QString &root)
+{
+    QStringList files;
+    const QDir apt_dir(rootPath(root, "/etc/apt/sources.list.d"));
+    for (const QFileInfo &file_info : apt_dir.entryInfoList(QStringList("*.list"), QDir::Files))
+        files << file_info.absoluteFilePath();
+    const QString sources_list = rootPath(root, "/etc/apt/sources.list");
+    if (QFileInfo(sources_list).size() != 0)
+        files << sources_list;
+    return files;
+}
+
+// Acquire::http::Proxy from the APT configuration, or what its ProxyAutoDetect script finds
+// (squid-deb-proxy-client discovers proxies on the LAN that way); empty if APT connects directly.
+// The script may take up to 5 s, so callers look the proxy up once per action.
+QString aptProxy(const QString &root)
+{
+    QStringList files {rootPath(root, "/etc/apt/apt.conf")};
+    for (const QFileInfo &file_info : QDir(rootPath(root, "/etc/apt/apt.conf.d")).entryInfoList(QDir::Files, QDir::Name))
+        files << file_info.absoluteFilePath();
+
+    static const QRegularExpression comment_re("(^|\\s)(//|#).*$", QRegularExpression::MultilineOption);
+    static const QRegularExpression proxy_re("Acquire\\s*(::|\\{)\\s*http\\s*(::|\\{)\\s*Proxy\\s+\"([^\"]*)\"",
+                                             QRegularExpression::CaseInsensitiveOption);
+    static const QRegularExpression detect_re("Acquire\\s*(::|\\{)\\s*http\\s*(::|\\{)\\s*Proxy-?Auto-?Detect\\s+\"([^\"]*)\"",
+                                              QRegularExpression::CaseInsensitiveOption);
+    QString proxy;
+    QString detect;
+    for (const QString &file : qAsConst(files)) { // later settings override earlier ones, in a file and across files
+        const QString config = readLines(file).join('\n').remove(comment_re);
+        QRegularExpressionMatchIterator it = proxy_re.globalMatch(config);
+        while (it.hasNext())
+            proxy = it.next().captured(3);
+        it = detect_re.globalMatch(config);
+        while (it.hasNext())
+            detect = it.next().captured(3);
+    }
+    if (proxy.startsWith("http://"))
+        return proxy;
+    if (detect.isEmpty() || !proxy.isEmpty() || (!root.isEmpty() && root != "/"))
+        return QString(); // "DIRECT", or a script that would have to run inside the root
+
+    QProcess process;
+    process.start(detect, QStringList());
+    if (!process.waitForFinished(5000)) {
+        process.kill();
+        return QString();
+    }
+    const QString detected = QString::fromUtf8(process.readAllStandardOutput()).trimmed();
+    return detected.startsWith("http://") ? detected : QString();
+}
+
+// mirror in the form a local cache like apt-cacher-ng serves without any client configuration,
+// e.g. "http://cache:3142/mxrepo.com" for "http://mxrepo.com"
+QString proxyForm(const QString &proxy, const QString &mirror)
+{
+    const QUrl url(mirror);
+    QString base = proxy;
+    while (base.endsWith('/'))
+        base.chop(1);
+    return base + '/' + url.host() + (url.port() > 0 ? ':' + QString::number(url.port()) : QString()) + url.path();
+}
+
+// mirror in proxy form for each of the caches that APT doesn't use as its proxy (from aptProxy()) already
+QStringList cacheCandidates(const QStringList &caches, const QString &mirror, const QString &proxy)
+{
+    QStringList candidates;
+    for (const QString &cache : caches)
+        if (!mirror.isEmpty() && QUrl(cache).adjusted(QUrl::StripTrailingSlash) != QUrl(proxy).adjusted(QUrl::StripTrailingSlash))
+            candidates << proxyForm(cache, mirror);
+    return candidates;
+}
+
+// mirror a local cache fetches from for a URL in proxy form (see proxyForm()), e.g. "http://mxrepo.com" for
+// "http://cache:3142/mxrepo.com"; the URL itself if it is not under one of the caches, empty if it is but names no host
+QString cacheUpstream(const QStringList &caches, const QString &url)
+{
+    for (const QString &cache : caches) {
+        QString base = cache;
+        while (base.endsWith('/'))
+            base.chop(1);
+        if (url != base && !url.startsWith(base + '/'))
+            continue;
+        const QUrl upstream("http://" + url.mid(base.size() + 1));
+        return upstream.host().isEmpty() ? QString() : upstream.toString();
+    }
+    return url;
+}
+
+// QLocale::Country for a country name as used in repos.txt, AnyCountry if unknown
+QLocale::Country countryByName(QString country)
+{
+    if (country == QLatin1String("The Netherlands"))
+        country = QStringLiteral("Netherlands");
+    if (country == QLatin1String("USA"))
+        country = QStringLiteral("UnitedStates");
+    const QMetaObject meta_object = QLocale::staticMetaObject;
+    const QMetaEnum meta_enum = meta_object.enumerator(meta_object.indexOfEnumerator("Country"));
+    const int value = meta_enum.keyToValue(country.remove(" ").toUtf8());
+    return value < 0 ? QLocale::AnyCountry : static_cast<QLocale::Country>(value);
+}
+
+// region of a country as in its time zone names ("Europe", "America", "Asia", ...), the one most of its zones are in
+QString continentOf(QLocale::Country country)
+{
+    if (country == QLocale::AnyCountry)
+        return QString();
+    QHash<QString, int> count;
+    for (const QByteArray &zone : QTimeZone::availableTimeZoneIds(country))
+        ++count[QString::fromLatin1(zone).section('/', 0, 0)];
+    QString continent;
+    for (auto it = count.constBegin(); it != count.constEnd(); ++it)
+        if (continent.isEmpty() || it.value() > count.value(continent))
+            continent = it.key();
+    return continent;
+}
+
+// region of this host from the system time zone, or from the country of the locale for zones like "Etc/UTC"
+QString localContinent()
+{
+    static const QStringList continents {"Africa", "America", "Antarctica", "Asia", "Atlantic", "Australia", "Europe", "Indian", "Pacific"};
+    const QString zone = QString::fromLatin1(QTimeZone::systemTimeZoneId()).section('/', 0, 0);
+    if (continents.contains(zone))
+        return zone;
+    return continentOf(QLocale::system().country());
+}
+
+// URLs of the "Country - URL" lines in the same region and of the worldwide mirrors, all of them if the region is unknown
+QStringList nearbyMirrors(const QStringList &repos, const QString &continent)
+{
+    if (continent.isEmpty())
+        return repoUrls(repos);
+    static const QStringList worldwide {"Anycast", "Any", "World"};
+    QStringList urls;
+    for (const QString &repo : repos) {
+        const QString country = repo.section("-", 0, 0).trimmed().section(",", 0, 0);
+        if (worldwide.contains(country) || continentOf(countryByName(country)) == continent)
+            urls << repoUrls({repo});
+    }
+    return urls;
+}
+
+// MX mirror in use as written in the sources, e.g. "http://mxrepo.com" or "http://cache:3142/mxrepo.com";
+// with a failover list the one APT tries first
+QString currentMXMirror(const QString &root)
+{
+    QString uri;
+    if (usesMirrorList(root)) {
+        for (const QString &line : readLines(rootPath(root, "/etc/apt/mirrors/mx-repo.list")))
+            if (line.startsWith("http")) {
+                uri = line.section('\t', 0, 0);
+                break;
+            }
+    } else {
+        static const QRegularExpression re("^deb.*/repo/ ");
+        for (const QString &line : readLines(rootPath(root, "/etc/apt/sources.list.d/mx.list")))
+            if (line.contains(re)) {
+                uri = line.section(' ', 1, 1);
+                break;
+            }
+    }
+    const int end = uri.indexOf("/mx/repo/");
+    return end < 0 ? uri : uri.left(end);
+}
+
+// what local caches fetch the MX repo from: the mirror in use (as in "mirrors" if it is there), for a cache in use
+// the mirror behind it; the first of "mirrors" if none is in use, empty if a cache in use doesn't name its mirror
+QString mxUpstream(const QStringList &mirrors, const QStringList &caches, const QString &root)
+{
+    const QString current = currentMXMirror(root);
+    if (current.isEmpty())
+        return mirrors.value(0);
+    const QString upstream = cacheUpstream(caches, current);
+    if (upstream.isEmpty())
+        return QString();
+    for (const QString &url : mirrors)
+        if (mirrorHost(url) == mirrorHost(upstream))
+            return url;
+    return upstream;
+}
+
+// host of the MX repo in use, with a failover list the one APT tries first
+QString currentMXRepo(const QString &root)
+{
+    return mirrorHost(currentMXMirror(root));
+}
+
+int debianVerNum(const QString &root)
+{
+    QFile file(rootPath(root, "/etc/debian_version"));
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+    const QString out = file.readAll().trimmed();
+    QStringList list = out.split(".");
+    bool ok;
+    int ver = list.at(0).toInt(&ok);
+    if (ok)
+      return ver;
+    else if (list.at(0).split("/").at(0) == "bullseye")
+      return 11;
+    else if (list.at(0).split("/").at(0) == "bookworm")
+      return 12;
+    else if (list.at(0).split("/").at(0) == "trixie")
+      return 13;
+    else
+      return 0; // unknown
+}
+
+// code name of a Debian release, empty if unknown
+QString debianVerName(int ver)
+{
+    switch (ver)
+    {
+    case 8:  return "jessie";
+    case 9:  return "stretch";
+    case 10: return "buster";
+    case 11: return "bullseye";
+    case 12: return "bookworm";
+    case 13: return "trixie";
+    default:
+        qDebug() << "Could not detect Debian version" << ver;
+        return QString();
+    }
+}
+
+QString mirrorHost(const QString &url)
+{
+    return QUrl(url).host();
+}
+
+// List available repos, "Country - URL" lines
+QStringList readRepoList(const QString &file_name)
+{
+    QFile file(file_name);
+    if (!file.open(QIODevice::ReadOnly))
+        qDebug() << "Count not open file: " << file.fileName();
+
+    QString file_content = file.readAll().trimmed();
+    file.close();
+
+    QStringList file_content_list = file_content.split("\n");
+    file_content_list.sort();
+
+    // remove commented out lines
+    QStringList repos;
+    for (const QString &line : file_content_list)
+        if (!line.startsWith("#"))
+            repos << line;
+    return repos;
+}
+
+// extract the URLs from the list of repos that contain country names and description
+QStringList repoUrls(const QStringList &repos)
+{
+    QStringList urls;
+    QStringList linelist;
+    for (const QString &line : repos) {
+        linelist = line.split("-");
+        linelist.removeAt(0);
+        urls << linelist.join("-").trimmed(); // rejoin any repos that contain "-"
+    }
+    return urls;
+}
+
+// replaces the lines in the APT files, each file is rewritten once
+bool setMXRepo(const QString &url, const QString &root)
+{
+    // antiX lines carry the Debian release, an unknown one fails this root before anything is written
+    const int ver_num = debianVerNum(root);
+    const bool antix = ver_num < 9 && QFileInfo::exists(rootPath(root, "/etc/antix-version")); // Added antix-version check in case running this on a MXfyied Debian
+    const QString ver_name = antix ? debianVerName(ver_num) : QString();
+    if (antix && ver_name.isEmpty()) {
+        qDebug() << "Unknown Debian version in" << rootPath(root, "/");
+        return false;
+    }
+
+    // mx source files to be edited (mx.list and mx16.list for MX15/16)
+    QStringList mx_files {rootPath(root, "/etc/apt/sources.list.d/mx.list")};
+    if (QFileInfo::exists(rootPath(root, "/etc/apt/sources.list.d/mx16.list")))
+        mx_files << rootPath(root, "/etc/apt/sources.list.d/mx16.list");
+
+    // for MX repos, plain lines and lines using the failover lists
+    const QString repo_line_mx = "deb " + url + "/mx/repo/ ";
+    const QString test_line_mx = "deb " + url + "/mx/testrepo/ ";
+    static const QRegularExpression repo_re("deb.*/repo/ ");
+    static const QRegularExpression test_re("deb.*/testrepo/ ");
+    static const QRegularExpression repo_list_re("deb\\s*mirror\\+file:/etc/apt/mirrors/mx-repo\\.list ");
+    static const QRegularExpression test_list_re("deb\\s*mirror\\+file:/etc/apt/mirrors/mx-testrepo\\.list ");
+    for (const QString &file : mx_files) {
+        bool ok = rewriteAptFile(file, [&](const QString &line) {
+            return QString(line).replace(repo_re, repo_line_mx).replace(test_re, test_line_mx)
+                    .replace(repo_list_re, repo_line_mx).replace(test_list_re, test_line_mx);
+        });
+        if (!ok)
+            return false;
+    }
+
+    if (antix) {
+        // for antiX repos
+        const QString repo_line_antix = (url == "http://mxrepo.com") ? "http://la.mxrepo.com/antix/" + ver_name + "/"
+                                                                     : url + "/antix/" + ver_name + "/";
+        const QRegularExpression antix_re("https?://.*/" + ver_name + "/?");
+        return rewriteAptFile(rootPath(root, "/etc/apt/sources.list.d/antix.list"), [&](const QString &line) {
+            return QString(line).replace(antix_re, repo_line_antix);
+        });
+    }
+    return true;
+}
+
+// enable or disable every source the filter matches, all files in one go; number of lines changed, -1 on error
+int setSourcesEnabled(const SourceFilter &filter, bool enable, const QString &root)
+{
+    static const QRegularExpression comment_re("^\\s*#+\\s*");
+    int changed = 0;
+    const bool ok = rewriteAptFiles(aptFiles(root), [&](const QString &file, const QString &line) {
+        if (line.isEmpty() || !line.contains("deb"))
+            return line;
+        const AptSource source = AptSource::parse(line);
+        if (source.enabled == enable || !filter.matches(file, source))
+            return line;
+        ++changed;
+        return enable ? QString(line).remove(comment_re) : "# " + line;
+    });
+    return ok ? changed : -1;
+}
+
+bool usesMirrorList(const QString &root)
+{
+    static const QRegularExpression re("^deb.*mirror\\+file:/etc/apt/mirrors/mx-repo\\.list");
+    for (const QString &line : readLines(rootPath(root, "/etc/apt/sources.list.d/mx.list")))
+        if (line.contains(re))
+            return true;
+    return false;
+}
+
+// failover lists for the MX repo and test repo, best mirror first
+bool writeMXMirrorLists(const QStringList &mirrors, const QString &root)
+{
+    QStringList repo_uris;
+    QStringList test_uris;
+    for (const QString &url : mirrors) {
+        repo_uris << url + "/mx/repo/";
+        test_uris << url + "/mx/testrepo/";
+    }
+    if (!QDir().mkpath(rootPath(root, "/etc/apt/mirrors")))
+        return false;
+    return writeMirrorList(rootPath(root, "/etc/apt/mirrors/mx-repo.list"), repo_uris)
+            && writeMirrorList(rootPath(root, "/etc/apt/mirrors/mx-testrepo.list"), test_uris);
+}
@@ -0,0 +1,36 @@
+#ifndef REPOCONFIG_H
+#define REPOCONFIG_H
+
+#include <QLocale>
+#include <QStringList>
+
+#include "aptsource.h"
+
+// APT configuration of MX repos shared by the GUI and the non-interactive modes,
+// "root" is the directory of the system to work on (e.g. a chroot), empty for the running system
+
+QString aptProxy(const QString &root = QString());
+QString cacheUpstream(const QStringList &caches, const QString &url);
+QLocale::Country countryByName(QString country);
+QString continentOf(QLocale::Country country);
+QString currentMXMirror(const QString &root = QString());
+QString currentMXRepo(const QString &root = QString());
+QString localContinent();
+QString debianVerName(int ver);
+QString mirrorHost(const QString &url);
+QString mxUpstream(const QStringList &mirrors, const QStringList &caches, const QString &root = QString());
+QString proxyForm(const QString &proxy, const QString &mirror);
+QString rootPath(const QString &root, const QString &path);
+QStringList aptFiles(const QString &root = QString());
+QStringList nearbyMirrors(const QStringList &repos, const QString &continent);
+QStringList cacheCandidates(const QStringList &caches, const QString &mirror, const QString &proxy);
+QStringList readRepoList(const QString &file_name = "/usr/share/mx-repo-list/repos.txt");
+QStringList repoUrls(const QStringList &repos);
+
+bool setMXRepo(const QString &url, const QString &root = QString());
+bool usesMirrorList(const QString &root = QString());
+bool writeMXMirrorLists(const QStringList &mirrors, const QString &root = QString());
+int setSourcesEnabled(const SourceFilter &filter, bool enable, const QString &root = QString());
+int debianVerNum(const QString &root = QString());
+
+#endif // REPOCONFIG_H
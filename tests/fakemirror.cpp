@@ -0,0 +1,104 @@
+#include "fakemirror.h"
+
+#include <QLocale>
+#include <QRandomGenerator>
+#include <QSharedPointer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUrl>
+
+FakeMirror::FakeMirror(QObject *parent)
+    : QTcpServer(parent)
+{
+    listen(QHostAddress::LocalHost);
+}
+
+QString FakeMirror::url() const
+{
+    return QString("http://127.0.0.1:%1").arg(serverPort());
+}
+
+void FakeMirror::serve(const QString &path, const FakeResponse &response)
+{
+    responses.insert(path, response);
+}
+
+// start of an InRelease file published at "date", padded with comment lines to "size" bytes
+QByteArray FakeMirror::inRelease(const QDateTime &date, int size)
+{
+    QByteArray data = "Origin: MX repository\nLabel: MX repository\nSuite: bullseye\nCodename: bullseye\nDate: "
+            + QLocale::c().toString(date.toUTC(), "ddd, dd MMM yyyy HH:mm:ss 'UTC'").toLatin1() + "\n";
+    while (data.size() < size)
+        data += "# " + QByteArray(qMin(76, size - data.size()), 'x') + "\n";
+    return data;
+}
+
+void FakeMirror::incomingConnection(qintptr handle)
+{
+    auto *socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(handle)) {
+        delete socket;
+        return;
+    }
+    // connections that never send a request (e.g. opened ahead of one) are simply closed by the client
+    connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+        buffers.remove(socket);
+        socket->deleteLater();
+    });
+    connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+        QByteArray &buffer = buffers[socket];
+        buffer += socket->readAll();
+        const int end = buffer.indexOf("\r\n\r\n");
+        if (end < 0)
+            return;
+        const QList<QByteArray> request_line = buffer.left(buffer.indexOf("\r\n")).split(' ');
+        buffer.remove(0, end + 4);
+        if (request_line.size() == 3)
+            respond(socket, request_line.at(0), request_line.at(1));
+    });
+}
+
+void FakeMirror::respond(QTcpSocket *socket, const QByteArray &method, const QByteArray &target)
+{
+    targets << QString::fromLatin1(target);
+    FakeResponse response;
+    response.status = 404;
+    response.body = "Not Found\n";
+    response = responses.value(QUrl(QString::fromLatin1(target)).path(), response);
+
+    const QHash<int, QByteArray> reasons {{200, "OK"}, {301, "Moved Permanently"}, {302, "Found"}, {403, "Forbidden"}, {404, "Not Found"},
+                                          {500, "Internal Server Error"}, {503, "Service Unavailable"}};
+    const QByteArray head = "HTTP/1.1 " + QByteArray::number(response.status) + " " + reasons.value(response.status, "Error")
+            + "\r\nContent-Type: application/octet-stream\r\nContent-Length: " + QByteArray::number(response.body.size())
+            + (response.location.isEmpty() ? QByteArray() : "\r\nLocation: " + response.location)
+            + "\r\nConnection: close\r\n\r\n";
+    const bool stalls = response.stall_after >= 0 && method != "HEAD";
+    QByteArray body;
+    if (method != "HEAD")
+        body = stalls ? response.body.left(response.stall_after) : response.body;
+    const int delay = response.latency + (response.jitter > 0 ? static_cast<int>(QRandomGenerator::global()->bounded(response.jitter + 1)) : 0);
+
+    // timers are children of the socket, a client that gives up takes them along
+    QTimer::singleShot(delay, socket, [socket, head, body, stalls, response]() {
+        socket->write(head);
+        if (response.bandwidth <= 0) {
+            socket->write(body);
+            if (!stalls)
+                socket->disconnectFromHost();
+            return;
+        }
+        auto *pace = new QTimer(socket);
+        auto sent = QSharedPointer<int>::create(0);
+        const int chunk = qMax(1, response.bandwidth / 100);
+        QObject::connect(pace, &QTimer::timeout, socket, [socket, pace, sent, body, chunk, stalls]() {
+            socket->write(body.mid(*sent, chunk));
+            *sent += chunk;
+            if (*sent < body.size())
+                return;
+            pace->stop();
+            if (!stalls)
+                socket->disconnectFromHost();
+        });
+        pace->start(10);
+    });
+}
@@ -0,0 +1,46 @@
+#ifndef FAKEMIRROR_H
+#define FAKEMIRROR_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QStringList>
+#include <QTcpServer>
+
+class QTcpSocket;
+
+// how the fake mirror answers a path
+struct FakeResponse
+{
+    int status = 200;
+    QByteArray body;
+    QByteArray location;    // sent as "Location:" for redirects
+    int latency = 0;        // ms before the status line
+    int jitter = 0;         // up to this many ms more, drawn for each request
+    int bandwidth = 0;      // bytes/s for the body, 0 sends it at once
+    int stall_after = -1;   // bytes of the body sent before it stops sending and keeps the connection open, -1 sends all
+};
+
+// HTTP server on localhost that plays a mirror (or a proxy: requests with an absolute URI are answered by path)
+class FakeMirror : public QTcpServer
+{
+    Q_OBJECT
+public:
+    explicit FakeMirror(QObject *parent = nullptr);
+
+    QString url() const;
+    void serve(const QString &path, const FakeResponse &response);
+    static QByteArray inRelease(const QDateTime &date, int size = 0);
+
+    QStringList targets; // request targets as received, in order
+
+protected:
+    void incomingConnection(qintptr handle) override;
+
+private:
+    void respond(QTcpSocket *socket, const QByteArray &method, const QByteArray &target);
+
+    QHash<QTcpSocket *, QByteArray> buffers;
+    QHash<QString, FakeResponse> responses;
+};
+
+#endif // FAKEMIRROR_H
@@ -0,0 +1,26 @@
+# Tests of the mirror probes against fake mirrors on localhost, run with: qmake && make check
+
+QT       += core network testlib
+QT       -= gui
+CONFIG   += c++17 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_mirrorprobe
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ..
+
+SOURCES += tst_mirrorprobe.cpp \
+    fakemirror.cpp \
+    ../aptsource.cpp \
+    ../mirrorprobe.cpp \
+    ../probesession.cpp \
+    ../repoconfig.cpp
+
+HEADERS += fakemirror.h \
+    ../aptsource.h \
+    ../mirrorprobe.h \
+    ../probesession.h \
+    ../repoconfig.h
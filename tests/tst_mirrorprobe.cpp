@@ -0,0 +1,381 @@
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "fakemirror.h"
+#include "mirrorprobe.h"
+#include "repoconfig.h"
+
+// the probes and downloads run against mirrors on localhost that answer the way real ones misbehave
+class TestMirrorProbe : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void rankPutsStaleAfterFresh();
+    void runRanksBySpeed();
+    void runMarksStaleMirror();
+    void runRanksFailuresLast();
+    void runAbortsStalledMirror();
+    void runCountsRedirectAsSetup();
+    void failoverListsBestFirst();
+    void fetchFileKeepsSlowDownload();
+    void fetchFileAbortsStall();
+    void aptProxyTakesLastSetting();
+    void runGoesThroughProxy();
+    void cacheCandidatesServeMirror();
+    void cacheUpstreamBehindCacheInUse();
+    void updateLinesMatchTheirSource();
+
+private:
+    const QString path = "/mx/repo/dists/bullseye/InRelease";
+};
+
+static bool writeFile(const QString &name, const QByteArray &data)
+{
+    QFile file(name);
+    return QDir().mkpath(QFileInfo(name).absolutePath()) && file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+static QStringList urls(const QList<MirrorResult> &results)
+{
+    QStringList list;
+    for (const MirrorResult &result : results)
+        list << result.url;
+    return list;
+}
+
+void TestMirrorProbe::rankPutsStaleAfterFresh()
+{
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    MirrorResult failed;
+    failed.url = "failed";
+    MirrorResult fast_stale;
+    fast_stale.url = "fast_stale";
+    fast_stale.latency = 10;
+    fast_stale.updated = now.addDays(-3);
+    MirrorResult slow_fresh;
+    slow_fresh.url = "slow_fresh";
+    slow_fresh.latency = 500;
+    slow_fresh.updated = now;
+
+    QList<MirrorResult> results {failed, fast_stale, slow_fresh};
+    MirrorProbe::rank(results);
+    QCOMPARE(urls(results), QStringList({"slow_fresh", "fast_stale", "failed"}));
+    QVERIFY(results.at(1).stale);
+    QVERIFY(!results.at(0).stale);
+}
+
+void TestMirrorProbe::runRanksBySpeed()
+{
+    const QByteArray release = FakeMirror::inRelease(QDateTime::currentDateTimeUtc(), 64 * 1024);
+    FakeMirror fast, jittery, slow, throttled;
+    FakeResponse response;
+    response.body = release;
+    fast.serve(path, response);
+    response.latency = 400;
+    response.jitter = 100;
+    jittery.serve(path, response);
+    response.latency = 1200;
+    response.jitter = 0;
+    slow.serve(path, response);
+    response.latency = 0;
+    response.bandwidth = 128 * 1024;
+    throttled.serve(path, response);
+
+    QNetworkAccessManager manager;
+    MirrorProbe probe(&manager);
+    const QList<MirrorResult> results = probe.run({throttled.url(), slow.url(), jittery.url(), fast.url()}, path);
+    QCOMPARE(urls(results), QStringList({fast.url(), jittery.url(), slow.url(), throttled.url()}));
+    for (const MirrorResult &result : results) {
+        QVERIFY(result.ok());
+        QVERIFY(!result.stale);
+        QVERIFY(result.setup >= 0);
+        QCOMPARE(result.bytes, qint64(release.size()));
+    }
+    QVERIFY(results.at(1).latency >= 400);
+    QVERIFY(results.at(2).latency >= 1200);
+    QVERIFY(results.at(3).throughput < 256 * 1024);
+}
+
+void TestMirrorProbe::runMarksStaleMirror()
+{
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    FakeMirror fresh, stale;
+    FakeResponse response;
+    response.body = FakeMirror::inRelease(now.addDays(-3));
+    stale.serve(path, response);
+    response.body = FakeMirror::inRelease(now);
+    response.latency = 300;
+    fresh.serve(path, response);
+
+    QNetworkAccessManager manager;
+    MirrorProbe probe(&manager);
+    const QList<MirrorResult> results = probe.run({stale.url(), fresh.url()}, path);
+    QCOMPARE(urls(results), QStringList({fresh.url(), stale.url()}));
+    QVERIFY(results.at(1).ok());
+    QVERIFY(results.at(1).stale);
+    QCOMPARE(results.at(1).updated.date(), now.addDays(-3).date());
+}
+
+void TestMirrorProbe::runRanksFailuresLast()
+{
+    FakeMirror working, broken, unavailable, missing, gone;
+    FakeResponse response;
+    response.body = FakeMirror::inRelease(QDateTime::currentDateTimeUtc());
+    response.latency = 300;
+    working.serve(path, response);
+    response.latency = 0;
+    response.status = 500;
+    broken.serve(path, response);
+    response.status = 503;
+    unavailable.serve(path, response);
+    const QString refused = gone.url();
+    gone.close();
+
+    QNetworkAccessManager manager;
+    MirrorProbe probe(&manager);
+    const QList<MirrorResult> results = probe.run({broken.url(), unavailable.url(), missing.url(), refused, working.url()}, path);
+    QCOMPARE(results.size(), 5);
+    QCOMPARE(results.first().url, working.url());
+    QVERIFY(results.first().ok());
+    for (int i = 1; i < results.size(); ++i)
+        QVERIFY2(!results.at(i).ok(), qPrintable(results.at(i).url));
+}
+
+void TestMirrorProbe::runAbortsStalledMirror()
+{
+    FakeMirror working, stalled;
+    FakeResponse response;
+    response.body = FakeMirror::inRelease(QDateTime::currentDateTimeUtc(), 64 * 1024);
+    working.serve(path, response);
+    response.stall_after = 1000;
+    stalled.serve(path, response);
+
+    QNetworkAccessManager manager;
+    MirrorProbe probe(&manager);
+    probe.timeout = 1000;
+    QElapsedTimer elapsed;
+    elapsed.start();
+    const QList<MirrorResult> results = probe.run({stalled.url(), working.url()}, path);
+    QVERIFY(elapsed.elapsed() < 3000);
+    QCOMPARE(urls(results), QStringList({working.url(), stalled.url()}));
+    QVERIFY(results.first().ok());
+    QVERIFY(!results.last().ok());
+}
+
+// the way to a mirror that redirects elsewhere is setup, only the request that gets the file counts as latency
+void TestMirrorProbe::runCountsRedirectAsSetup()
+{
+    FakeMirror redirecting, target;
+    FakeResponse response;
+    response.body = FakeMirror::inRelease(QDateTime::currentDateTimeUtc());
+    response.latency = 300;
+    target.serve(path, response);
+    response.status = 302;
+    response.body.clear();
+    response.latency = 600;
+    response.location = (target.url() + path).toLatin1();
+    redirecting.serve(path, response);
+
+    QNetworkAccessManager manager;
+    MirrorProbe probe(&manager);
+    const QList<MirrorResult> results = probe.run({redirecting.url()}, path);
+    QCOMPARE(results.size(), 1);
+    QVERIFY(results.first().ok());
+    QVERIFY(results.first().setup >= 600);
+    QVERIFY(results.first().latency >= 300);
+    QVERIFY(results.first().latency < 600);
+    QVERIFY(results.first().updated.isValid());
+    QCOMPARE(target.targets, QStringList({path}));
+
+    QVERIFY(ProbeSession::origin(QUrl("http://mirror/x")) != ProbeSession::origin(QUrl("https://mirror:8443/x")));
+    QCOMPARE(ProbeSession::origin(QUrl("https://mirror/x")), ProbeSession::origin(QUrl("https://mirror:443/y")));
+}
+
+// the mirrors pushFailover_clicked() and the CLI put in the lists: working ones only, fastest first
+void TestMirrorProbe::failoverListsBestFirst()
+{
+    FakeMirror fast, middle, slow, broken;
+    FakeResponse response;
+    response.body = FakeMirror::inRelease(QDateTime::currentDateTimeUtc());
+    fast.serve(path, response);
+    response.latency = 300;
+    middle.serve(path, response);
+    response.latency = 900;
+    slow.serve(path, response);
+    response.latency = 0;
+    response.status = 500;
+    broken.serve(path, response);
+
+    QNetworkAccessManager manager;
+    MirrorProbe probe(&manager);
+    const QList<MirrorResult> results = probe.run({broken.url(), slow.url(), middle.url(), fast.url()}, path);
+    QStringList mirrors;
+    for (const MirrorResult &result : results)
+        if (result.ok() && mirrors.size() < 3)
+            mirrors << result.url;
+
+    QTemporaryDir root;
+    QVERIFY(root.isValid());
+    QVERIFY(writeMXMirrorLists(mirrors, root.path()));
+    QFile file(root.path() + "/etc/apt/mirrors/mx-repo.list");
+    QVERIFY(file.open(QIODevice::ReadOnly | QIODevice::Text));
+    QStringList lines = QString::fromUtf8(file.readAll()).split('\n', QString::SkipEmptyParts);
+    QVERIFY(lines.takeFirst().startsWith('#'));
+    QCOMPARE(lines, QStringList({fast.url() + "/mx/repo/\tpriority:1",
+                                 middle.url() + "/mx/repo/\tpriority:2",
+                                 slow.url() + "/mx/repo/\tpriority:3"}));
+
+    // the update size estimate asks the mirror APT tries first
+    const AptSource source = AptSource::parse("deb mirror+file:" + file.fileName() + " bullseye main");
+    QCOMPARE(source.indexUrls({"amd64"}), QStringList({fast.url() + "/mx/repo/dists/bullseye/InRelease",
+                                                       fast.url() + "/mx/repo/dists/bullseye/main/binary-amd64/Packages.xz"}));
+}
+
+// a mirror that sends slowly but steadily is not a stalled one
+void TestMirrorProbe::fetchFileKeepsSlowDownload()
+{
+    FakeMirror mirror;
+    FakeResponse response;
+    response.body = QByteArray(16 * 1024, 'z');
+    response.bandwidth = 32 * 1024;
+    mirror.serve("/sources.zip", response);
+
+    QNetworkAccessManager manager;
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    bool write_error = true;
+    QVERIFY(fetchFile(&manager, mirror.url() + "/sources.zip", &buffer, 300, &write_error));
+    QVERIFY(!write_error);
+    QCOMPARE(buffer.data(), response.body);
+}
+
+void TestMirrorProbe::fetchFileAbortsStall()
+{
+    FakeMirror mirror;
+    FakeResponse response;
+    response.body = QByteArray(64 * 1024, 'z');
+    response.stall_after = 4096;
+    mirror.serve("/sources.zip", response);
+
+    QNetworkAccessManager manager;
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    bool write_error = true;
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QVERIFY(!fetchFile(&manager, mirror.url() + "/sources.zip", &buffer, 500, &write_error));
+    QVERIFY(elapsed.elapsed() < 3000);
+    QVERIFY(!write_error);
+    QCOMPARE(buffer.data().size(), 4096);
+}
+
+// files are read in order and a setting overrides the ones before it, in a file and across files
+void TestMirrorProbe::aptProxyTakesLastSetting()
+{
+    QTemporaryDir root;
+    QVERIFY(root.isValid());
+    QVERIFY(writeFile(root.path() + "/etc/apt/apt.conf", "Acquire::http::Proxy \"http://first:3142\";\n"));
+    QVERIFY(writeFile(root.path() + "/etc/apt/apt.conf.d/01proxy",
+                      "Acquire::http::Proxy \"http://second:3142\";\n"
+                      "Acquire { http { Proxy \"http://third:3142\"; }; };\n"
+                      "// Acquire::http::Proxy \"http://commented:3142\";\n"));
+    QCOMPARE(aptProxy(root.path()), QString("http://third:3142"));
+
+    QVERIFY(writeFile(root.path() + "/etc/apt/apt.conf.d/99direct", "Acquire::http::Proxy \"DIRECT\";\n"));
+    QCOMPARE(aptProxy(root.path()), QString());
+}
+
+// with APT's proxy the probes go where APT's downloads go, the mirror itself need not be reachable
+void TestMirrorProbe::runGoesThroughProxy()
+{
+    FakeMirror proxy;
+    FakeResponse response;
+    response.body = FakeMirror::inRelease(QDateTime::currentDateTimeUtc());
+    proxy.serve(path, response);
+
+    QNetworkAccessManager manager;
+    MirrorProbe probe(&manager);
+    probe.proxy = proxy.url();
+    const QList<MirrorResult> results = probe.run({"http://mirror.invalid"}, path);
+    QCOMPARE(results.size(), 1);
+    QVERIFY(results.first().ok());
+    QCOMPARE(proxy.targets, QStringList({"http://mirror.invalid" + path}));
+
+    // no direct connections to compare the schemes over either
+    QCOMPARE(probe.cheaperScheme("http://mirror.invalid", path), QString("http://mirror.invalid"));
+    QCOMPARE(proxy.targets.size(), 1);
+}
+
+// a local cache in proxy form is probed like a mirror, except when it is APT's proxy already
+void TestMirrorProbe::cacheCandidatesServeMirror()
+{
+    FakeMirror cache;
+    FakeResponse response;
+    response.body = FakeMirror::inRelease(QDateTime::currentDateTimeUtc());
+    cache.serve("/mirror.invalid" + path, response);
+
+    QCOMPARE(cacheCandidates({cache.url()}, "http://mirror.invalid", cache.url() + "/"), QStringList());
+    const QStringList candidates = cacheCandidates({cache.url()}, "http://mirror.invalid", QString());
+    QCOMPARE(candidates, QStringList({cache.url() + "/mirror.invalid"}));
+
+    QNetworkAccessManager manager;
+    MirrorProbe probe(&manager);
+    const QList<MirrorResult> results = probe.run(candidates, path);
+    QCOMPARE(results.size(), 1);
+    QVERIFY(results.first().ok());
+}
+
+// with a cache in use the caches keep fetching from the mirror behind it, not from one in proxy form again
+void TestMirrorProbe::cacheUpstreamBehindCacheInUse()
+{
+    const QStringList caches {"http://localhost:3142/"};
+    QCOMPARE(cacheUpstream(caches, "http://localhost:3142/deb.debian.org/debian/"), QString("http://deb.debian.org/debian/"));
+    QCOMPARE(cacheUpstream(caches, "http://deb.debian.org/debian/"), QString("http://deb.debian.org/debian/"));
+    QCOMPARE(cacheUpstream(caches, "http://localhost:3142"), QString());
+
+    QTemporaryDir root;
+    QVERIFY(root.isValid());
+    const QStringList mirrors {"http://la.mxrepo.com", "https://mxrepo.com"};
+    QVERIFY(writeFile(root.path() + "/etc/apt/sources.list.d/mx.list",
+                      "deb http://localhost:3142/mxrepo.com/mx/repo/ bullseye main non-free\n"));
+    QCOMPARE(mxUpstream(mirrors, caches, root.path()), QString("https://mxrepo.com"));
+    QVERIFY(cacheCandidates(caches, mxUpstream(mirrors, caches, root.path()), QString()).first().endsWith("/mxrepo.com"));
+
+    QVERIFY(writeFile(root.path() + "/etc/apt/sources.list.d/mx.list", "deb http://localhost:3142/mx/repo/ bullseye main\n"));
+    QCOMPARE(mxUpstream(mirrors, caches, root.path()), QString());
+    QCOMPARE(cacheCandidates(caches, QString(), QString()), QStringList());
+}
+
+// the lines of "apt-get update" are credited to the source that fetched them, deb and deb-src apart
+void TestMirrorProbe::updateLinesMatchTheirSource()
+{
+    const AptSource deb = AptSource::parse("deb http://deb.debian.org/debian bullseye main contrib");
+    const AptSource deb_src = AptSource::parse("deb-src http://deb.debian.org/debian/ bullseye main");
+    const AptSource non_free = AptSource::parse("deb http://deb.debian.org/debian bullseye non-free");
+
+    const UpdateLine release = UpdateLine::parse("Hit:1 http://deb.debian.org/debian bullseye InRelease");
+    QVERIFY(release.matches(deb) && release.matches(deb_src) && release.matches(non_free));
+
+    const UpdateLine packages = UpdateLine::parse("Get:2 http://deb.debian.org/debian bullseye/main amd64 Packages [8,183 kB]");
+    QCOMPARE(packages.index, QString("amd64 Packages"));
+    QCOMPARE(packages.bytes, qint64(8183000));
+    QVERIFY(packages.matches(deb));
+    QVERIFY(!packages.matches(deb_src));
+    QVERIFY(!packages.matches(non_free));
+
+    const UpdateLine sources = UpdateLine::parse("Get:3 http://deb.debian.org/debian bullseye/main Sources [8,636 kB]");
+    QVERIFY(sources.matches(deb_src));
+    QVERIFY(!sources.matches(deb));
+
+    const UpdateLine translation = UpdateLine::parse("Get:4 http://deb.debian.org/debian bullseye/contrib Translation-en [46.9 kB]");
+    QVERIFY(translation.matches(deb));
+    QVERIFY(!translation.matches(deb_src));
+    QVERIFY(!translation.matches(non_free));
+}
+
+QTEST_GUILESS_MAIN(TestMirrorProbe)
+
+#include "tst_mirrorprobe.moc"